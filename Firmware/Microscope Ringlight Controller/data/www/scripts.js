@@ -2,13 +2,11 @@ var ledstate = false;
 var brightness = 0;
 var temperature = 5000;
 var direction = 0;
+var generation = null;
 
 window.onload = function() {
-    // Get status on page load
-    getStatus();
-
-    // Then set up to call every 2 seconds
-    setInterval(getStatus, 2000);
+    // Get status on page load, then wait for changes
+    pollStatus();
 };
 
 function toggleLED(state) {
@@ -97,37 +95,60 @@ function directionChange(val){
     }
 }
 
-async function getStatus() {
-    try {
-        const response = await fetch('/getstate');
-        if (!response.ok) {
-            throw new Error('Network response was not ok');
-        }
+async function pollStatus() {
+    // Long-poll /getstate: the server holds the request until the state changes, but only looks
+    // when the web server polls the connection, so an update can arrive up to about 500ms late.
+    // After a timeout with no change it answers with an empty body, and a plain request with a
+    // matching ETag gets 304; both mean ask again with the same generation.
+    while (true) {
+        try {
+            let url = '/getstate';
+            const headers = {};
+            if (generation !== null) {
+                url += '?since=' + generation;
+                headers['If-None-Match'] = '"' + generation + '"';
+            }
+
+            const response = await fetch(url, { headers: headers });
+            if (response.status === 304) {
+                continue;
+            }
+            if (!response.ok) {
+                throw new Error('Network response was not ok');
+            }
 
-        const data = await response.json();
+            const text = await response.text();
+            if (text.length === 0) {
+                continue;
+            }
+            const data = JSON.parse(text);
+            generation = data.generation;
 
-        if (data.lights && data.lights.length > 0) {
-            const light = data.lights[0];
+            if (data.lights && data.lights.length > 0) {
+                const light = data.lights[0];
 
-            document.getElementById('brightness').value = light.brightness;
-            document.getElementById('temperature').value = light.temperature;
-            document.getElementById('direction').value = light.direction;
+                document.getElementById('brightness').value = light.brightness;
+                document.getElementById('temperature').value = light.temperature;
+                document.getElementById('direction').value = light.direction;
 
-            document.getElementById('BrightnessLabel').innerHTML = light.brightness;
-            document.getElementById('TemperatureLabel').innerHTML = light.temperature;
-            document.getElementById('DirectionLabel').innerHTML = light.direction;
+                document.getElementById('BrightnessLabel').innerHTML = light.brightness;
+                document.getElementById('TemperatureLabel').innerHTML = light.temperature;
+                document.getElementById('DirectionLabel').innerHTML = light.direction;
 
-            document.getElementById('direction').max = data.numberOfLights;
+                document.getElementById('direction').max = data.numberOfLights;
 
-            if (light.on === 1) {
-                updatePowerButtons(true);
-            }
-            else{
-                updatePowerButtons(false);
+                if (light.on === 1) {
+                    updatePowerButtons(true);
+                }
+                else{
+                    updatePowerButtons(false);
+                }
             }
+        } catch (error) {
+            console.error('Failed to fetch light state:', error);
+            // Wait before trying again
+            await new Promise(resolve => setTimeout(resolve, 2000));
         }
-    } catch (error) {
-        console.error('Failed to fetch light state:', error);
     }
 }
 
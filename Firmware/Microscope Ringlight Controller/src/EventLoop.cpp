@@ -0,0 +1,57 @@
+#include <esp_timer.h>
+#include "EventLoop.h"
+
+TaskHandle_t EventLoop::loopTask = nullptr;
+volatile uint32_t EventLoop::wakes = 0;
+uint64_t EventLoop::startTime = 0;
+uint64_t EventLoop::idleTime = 0;
+
+void EventLoop::begin(){
+    // Must be called from the task that runs loop()
+    loopTask = xTaskGetCurrentTaskHandle();
+    startTime = esp_timer_get_time();
+}
+
+void EventLoop::wake(){
+    // Wake the main loop from another task, such as the web server. The loop task does not
+    // notify itself: it checks the deadlines of its queues before it waits, and a notification
+    // left pending would cut its next wait short and be counted as a wake.
+    if (loopTask != nullptr && xTaskGetCurrentTaskHandle() != loopTask) {
+        xTaskNotifyGive(loopTask);
+    }
+}
+
+void IRAM_ATTR EventLoop::wakeFromISR(){
+    // Wake the main loop from an interrupt handler
+    if (loopTask != nullptr) {
+        BaseType_t higherPriorityTaskWoken = pdFALSE;
+        vTaskNotifyGiveFromISR(loopTask, &higherPriorityTaskWoken);
+        if (higherPriorityTaskWoken) {
+            portYIELD_FROM_ISR();
+        }
+    }
+}
+
+void EventLoop::wait(uint32_t timeout){
+    // Block until woken or until timeout milliseconds have passed.
+    // While blocked the idle task runs and the CPU waits for an interrupt.
+    TickType_t ticks = timeout == WAIT_FOREVER ? portMAX_DELAY : pdMS_TO_TICKS(timeout);
+
+    uint64_t sleepStart = esp_timer_get_time();
+    if (ulTaskNotifyTake(pdTRUE, ticks) > 0) {
+        wakes++;
+    }
+    idleTime += esp_timer_get_time() - sleepStart;
+}
+
+uint32_t EventLoop::wakeCount(){
+    return wakes;
+}
+
+uint8_t EventLoop::loopIdlePercent(){
+    // Percentage of time since begin() the main loop task has spent blocked in wait().
+    // This is not CPU idle time: the web server and Wi-Fi tasks may run while the loop waits.
+    uint64_t elapsed = esp_timer_get_time() - startTime;
+    if (elapsed == 0) return 0;
+    return uint8_t(idleTime * 100 / elapsed);
+}
@@ -0,0 +1,26 @@
+#ifndef MICROSCOPE_RINGLIGHT_CONTROLLER_EVENTLOOP_H
+#define MICROSCOPE_RINGLIGHT_CONTROLLER_EVENTLOOP_H
+
+#include <Arduino.h>
+#include "Debug.h"
+
+// Lets the main loop sleep until an interrupt, web request or timer needs it
+class EventLoop {
+public:
+    static const uint32_t WAIT_FOREVER = UINT32_MAX;
+
+    static void begin();
+    static void wake();
+    static void IRAM_ATTR wakeFromISR();
+    static void wait(uint32_t timeout);
+    static uint32_t wakeCount();
+    static uint8_t loopIdlePercent();
+
+private:
+    static TaskHandle_t loopTask;
+    static volatile uint32_t wakes;
+    static uint64_t startTime;
+    static uint64_t idleTime;
+};
+
+#endif //MICROSCOPE_RINGLIGHT_CONTROLLER_EVENTLOOP_H
@@ -0,0 +1,168 @@
+#include "GroupController.h"
+#include <esp_system.h>
+
+static Preferences preferences;
+
+void GroupController::begin(){
+    // Load the group settings and start listening, called once Wi-Fi is connected
+    preferences.begin("storage", true);
+    uint8_t retrievedRole = preferences.getUChar("grouprole", RoleOff);
+    group = preferences.getUChar("groupid", 0);
+    preferences.end();
+
+    role = retrievedRole <= RoleMember ? static_cast<Role>(retrievedRole) : RoleOff;
+    session = esp_random();
+
+    TRACE("Group role: ")
+    TRACE(role)
+    TRACE("\nGroup: ")
+    TRACE(group)
+    TRACE("\n")
+
+    if (udp.listenMulticast(GROUP_ADDRESS, GROUP_PORT)) {
+        udp.onPacket([this](AsyncUDPPacket& packet) {
+            receive(packet);
+        });
+        listening = true;
+    }
+    else {
+        TRACELN("Error starting group multicast")
+    }
+}
+
+void GroupController::setRole(Role newRole, uint8_t newGroup){
+    role = newRole;
+    group = newGroup;
+    lastSendTime = millis() - GROUP_HEARTBEAT; // announce the leader's state straight away
+
+    preferences.begin("storage", false);
+    preferences.putUChar("grouprole", role);
+    preferences.putUChar("groupid", group);
+    preferences.end();
+
+    ledController.stateChanged(); // the group settings are part of /getstate
+    EventLoop::wake();
+}
+
+void GroupController::Process(){
+    if (!listening) return;
+
+    if (role == RoleLeader) {
+        // Send the state when it changes, and regularly so members can recover lost frames
+        GroupFrame current = {};
+        current.power = ledController.currentMode == LEDController::ModeOff ? 0 : 1;
+        current.brightness = ledController.currentBrightness;
+        current.temperature = ledController.currentTemperature;
+        current.direction = ledController.currentDirection;
+        current.source = ledController.renderSource;
+
+        bool changed = current.power != lastSent.power || current.brightness != lastSent.brightness ||
+                       current.temperature != lastSent.temperature || current.direction != lastSent.direction ||
+                       current.source != lastSent.source;
+        if (changed || millis() - lastSendTime >= GROUP_HEARTBEAT) {
+            lastSent = current;
+            sendState();
+        }
+    }
+    else if (role == RoleMember) {
+        // Apply the latest frame once its agreed time has been reached
+        GroupFrame frame;
+        {
+            std::lock_guard<std::mutex> lock(pendingMutex);
+            if (!framePending || int32_t(millis() - pendingApplyTime) < 0) return;
+            frame = pendingFrame;
+            framePending = false;
+        }
+        applyFrame(frame);
+    }
+}
+
+uint32_t GroupController::nextDeadline() const{
+    // Milliseconds until Process() has timed work to do
+    if (!listening) return EventLoop::WAIT_FOREVER;
+
+    if (role == RoleLeader) {
+        uint32_t elapsed = millis() - lastSendTime;
+        return elapsed >= GROUP_HEARTBEAT ? 0 : GROUP_HEARTBEAT - elapsed;
+    }
+    if (role == RoleMember && framePending) {
+        int32_t remaining = int32_t(pendingApplyTime - millis());
+        return remaining <= 0 ? 0 : uint32_t(remaining);
+    }
+    return EventLoop::WAIT_FOREVER;
+}
+
+void GroupController::sendState(){
+    uint32_t now = millis();
+    lastSent.magic = GROUP_FRAME_MAGIC;
+    lastSent.version = GROUP_FRAME_VERSION;
+    lastSent.group = group;
+    lastSent.session = session;
+    lastSent.sequence = ++sequence;
+    lastSent.senderTime = now;
+    lastSent.applyAt = now; // the leader has already shown this state, so members show it as soon as it arrives
+
+    udp.writeTo(reinterpret_cast<const uint8_t*>(&lastSent), sizeof(lastSent), GROUP_ADDRESS, GROUP_PORT);
+    lastSendTime = now;
+}
+
+void GroupController::receive(AsyncUDPPacket& packet){
+    // Runs on the UDP task, queue the frame for the main loop
+    if (role != RoleMember || packet.length() != sizeof(GroupFrame)) return;
+
+    GroupFrame frame;
+    memcpy(&frame, packet.data(), sizeof(frame));
+    if (frame.magic != GROUP_FRAME_MAGIC || frame.version != GROUP_FRAME_VERSION || frame.group != group) return;
+
+    // Any host on the network can send a frame, so check every value before it reaches the LED controller
+    if (frame.power > 1 || frame.direction > MAX_DIRECTION || frame.temperature < 1000 || frame.temperature > 12000 ||
+        frame.source > LEDController::RenderDirection) return;
+
+    uint32_t now = millis();
+    int32_t offset = int32_t(now - frame.senderTime);
+
+    std::lock_guard<std::mutex> lock(pendingMutex);
+    if (frame.session != senderSession) {
+        // New sender, or the sender restarted
+        senderSession = frame.session;
+        lastSequence = frame.sequence - 1;
+        clockOffset = offset;
+    }
+    if (int32_t(frame.sequence - lastSequence) <= 0) return; // duplicate or out of order
+    lastSequence = frame.sequence;
+
+    // The smallest offset seen is the one with the least network delay.
+    // Let it creep up slowly so it follows any drift between the two clocks.
+    clockOffset = std::min<int32_t>(offset, clockOffset + 1);
+
+    pendingFrame = frame;
+    pendingApplyTime = frame.applyAt + clockOffset;
+    framePending = true;
+    EventLoop::wake();
+}
+
+void GroupController::applyFrame(const GroupFrame& frame){
+    // Pass the changes to the LED controller through its event queue.
+    // The temperature fill and the direction pattern both draw every LED, so the one the sender
+    // shows is queued last, and again whenever the member shows the other one.
+    bool temperatureChanged = ledController.currentTemperature != frame.temperature;
+    bool directionChanged = ledController.currentDirection != frame.direction;
+    bool redraw = temperatureChanged || directionChanged || ledController.renderSource != frame.source;
+    if (frame.source == LEDController::RenderDirection) {
+        if (temperatureChanged) LEDController::setTemperature(frame.temperature);
+        if (redraw) LEDController::setDirection(frame.direction);
+    }
+    else {
+        if (directionChanged) LEDController::setDirection(frame.direction);
+        if (redraw) LEDController::setTemperature(frame.temperature);
+    }
+    if (frame.power == 1 && ledController.currentBrightness != frame.brightness){
+        LEDController::setBrightness(frame.brightness);
+    }
+    if (frame.power == 1 && ledController.currentMode == LEDController::ModeOff) {
+        LEDController::On();
+    }
+    else if (frame.power == 0 && ledController.currentMode != LEDController::ModeOff) {
+        LEDController::Off();
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef MICROSCOPE_RINGLIGHT_CONTROLLER_GROUPCONTROLLER_H
+#define MICROSCOPE_RINGLIGHT_CONTROLLER_GROUPCONTROLLER_H
+
+#include <AsyncUDP.h>
+#include <Preferences.h>
+#include <mutex>
+#include "LEDController.h"
+#include "EventLoop.h"
+#include "Debug.h"
+
+#define GROUP_ADDRESS   IPAddress(239, 84, 82, 76)
+#define GROUP_PORT      4210
+
+// Information about the group frames
+#define GROUP_FRAME_MAGIC   0x52475250 // "RGRP"
+#define GROUP_FRAME_VERSION 2 // 2 added source
+#define GROUP_HEARTBEAT     1000 // leader resends its state every 1s
+
+// State frame multicast to every controller in a group.
+// A leader sends one whenever its state changes and again every second so lost frames are recovered.
+// Its frames have applyAt equal to senderTime, so members show them as soon as they arrive.
+// Any client can send the same frame to drive a group of members, with applyAt in the future
+// so every member shows the change at the same instant.
+struct __attribute__((packed)) GroupFrame {
+    uint32_t magic; // GROUP_FRAME_MAGIC
+    uint8_t version; // GROUP_FRAME_VERSION
+    uint8_t group; // group number, members ignore other groups
+    uint32_t session; // random number chosen by the sender at startup
+    uint32_t sequence; // increases by one for each frame in a session
+    uint32_t senderTime; // sender's millis() when the frame was sent
+    uint32_t applyAt; // sender's millis() at which the state should be shown
+    uint8_t power; // 1 = on, 0 = off
+    uint8_t brightness;
+    uint16_t temperature;
+    uint8_t direction;
+    uint8_t source; // LEDController::RenderSource, whether the temperature fill or the direction pattern is shown
+};
+
+class GroupController {
+public:
+    // Group roles
+    enum Role{RoleOff = 0, RoleLeader = 1, RoleMember = 2};
+
+    // Constructor that initializes the ledController reference
+    explicit GroupController(LEDController& controller) : ledController(controller) {}
+    void begin();
+    void Process();
+    uint32_t nextDeadline() const;
+    void setRole(Role newRole, uint8_t newGroup);
+
+    Role role = RoleOff;
+    uint8_t group = 0;
+
+private:
+    LEDController& ledController; // Declare a reference to LEDController
+    AsyncUDP udp;
+    bool listening = false;
+
+    // Leader state
+    uint32_t session = 0;
+    uint32_t sequence = 0;
+    uint32_t lastSendTime = 0;
+    GroupFrame lastSent = {};
+
+    // Member state, written by the UDP task and read by the main loop
+    std::mutex pendingMutex;
+    bool framePending = false;
+    GroupFrame pendingFrame = {};
+    uint32_t pendingApplyTime = 0; // local millis() at which pendingFrame is applied
+    uint32_t senderSession = 0;
+    uint32_t lastSequence = 0;
+    int32_t clockOffset = 0; // local time minus sender time, smallest seen
+
+    void receive(AsyncUDPPacket& packet);
+    void sendState();
+    void applyFrame(const GroupFrame& frame);
+};
+
+#endif //MICROSCOPE_RINGLIGHT_CONTROLLER_GROUPCONTROLLER_H
@@ -1,11 +1,17 @@
 #include "LEDController.h"
 #include <queue>
+#include <mutex>
+#include <esp_attr.h>
+#include <esp_system.h>
+#include "EventLoop.h"
 
 static Preferences preferences;
 
 // Information about the default program values
 const uint8_t DEFAULT_BRIGHTNESS = 150;
 const uint16_t DEFAULT_TEMPERATURE = 4500;
+const uint8_t DEFAULT_DIRECTION = 0;
+const uint8_t DEFAULT_MODE = 0; // ModeBrightness
 
 // Information about the colours the LEDs will flash when setting a mode
 const CRGB MODE_BRIGHTNESS_COLOUR = CRGB(0, 0, 255); // blue
@@ -13,10 +19,29 @@ const CRGB MODE_TEMPERATURE_COLOUR = CRGB(255, 0, 255); // purple
 const CRGB MODE_DIRECTION_COLOUR = CRGB(0, 255, 0); // green
 const uint16_t MODE_FLASH_DURATION = 500; // 0.5s
 
+// Changes are written to flash once the state has been stable for this long, to limit flash wear
+const uint32_t SAVE_DELAY = 2000; // 2s
+static bool savePending = false;
+static uint32_t saveRequestTime = 0;
+
 // Event Operation
-enum EventOperations{BrightnessOperation = 1, TemperatureOperation = 2, DirectionOperation = 3, PowerOperation = 4};
+enum EventOperations{BrightnessOperation = 1, TemperatureOperation = 2, DirectionOperation = 3, PowerOperation = 4, CalibrationOperation = 5};
+
+static CRGB Frame[LED_COUNT]; // uncalibrated colour of each pixel
+static CRGB LEDs[LED_COUNT]; // calibrated output sent to the ring
+
+// Per-pixel calibration, loaded from flash at begin()
+static uint8_t CalibrationGains[LED_COUNT][3];
+static uint8_t GammaTable[256];
 
-static CRGB LEDs[LED_COUNT];
+// Power model, FrameLoad is the sum of every channel value in LEDs[] and is updated as pixels change
+static uint32_t FrameLoad = 0;
+static uint8_t OutputBrightness = 0; // brightness requested before power limiting
+static uint16_t EstimatedCurrent = LED_COUNT * LED_IDLE_MA; // mA drawn by the last frame shown
+
+// Calibration received from the web server, waiting to be applied by Process()
+static uint8_t PendingGains[LED_COUNT][3];
+static uint8_t PendingGamma = CALIBRATION_GAMMA_LINEAR;
 
 // Define a struct to represent an event
 struct LEDEvent {
@@ -28,12 +53,49 @@ struct LEDEvent {
 };
 
 std::queue<LEDEvent> LedEvents;
+std::mutex LedEventsMutex; // events are added by the web server task and removed by the main loop
+
+// Copy of the saved state kept in RTC memory so a warm reset can restore it without reading flash
+const uint32_t STATE_SNAPSHOT_MAGIC = 0x52494E47; // "RING"
+struct StateSnapshot {
+    uint32_t magic;
+    uint8_t brightness;
+    uint16_t temperature;
+    uint8_t direction;
+    uint8_t mode;
+};
+RTC_NOINIT_ATTR static StateSnapshot stateSnapshot;
+
+static void enqueueEvent(EventOperations name, uint16_t parameter){
+    // Add an event to the queue, events are never refused here so local input is always applied
+    {
+        std::lock_guard<std::mutex> lock(LedEventsMutex);
+        if (!LedEvents.empty() && LedEvents.back().name == name) {
+            // Merge with the last event of the same type, only the newest value matters
+            LedEvents.back().parameter = parameter;
+        }
+        else {
+            LedEvents.emplace(name, parameter);
+        }
+    }
+    EventLoop::wake();
+}
+
+bool LEDController::eventQueueFull(){
+    // Checked by the web server before adding events, so request floods are refused
+    // while leaving room for the encoder, mode flashes and group frames
+    std::lock_guard<std::mutex> lock(LedEventsMutex);
+    return LedEvents.size() >= EVENT_QUEUE_LIMIT;
+}
 
 void LEDController::Process(){
     // Process the event queue
-    while (!LedEvents.empty()) {
+    while (true) {
+        std::unique_lock<std::mutex> lock(LedEventsMutex);
+        if (LedEvents.empty()) break;
         LEDEvent ev = LedEvents.front(); // Get the operation at the front of the queue
         LedEvents.pop(); // Remove the operation from the queue
+        lock.unlock();
 
         switch (ev.name){
             case BrightnessOperation:
@@ -50,32 +112,73 @@ void LEDController::Process(){
             case PowerOperation:
                 PowerEvent(ev.parameter);
                 break;
+
+            case CalibrationOperation:
+                CalibrationEvent();
+                break;
             default:
                 break;
         }
+        stateChanged();
+    }
+
+    // Write any changed values to flash once they have settled
+    if (savePending && millis() - saveRequestTime >= SAVE_DELAY) {
+        commitState();
     }
 }
 
-void LEDController::begin(){
-    // Set variable values
-    // LED Variables
+void LEDController::stateChanged(){
+    stateGeneration++; // atomic, also called from the web server task
+}
 
-    currentDirection = 0;
+uint32_t LEDController::nextDeadline() const{
+    // Milliseconds until Process() has work to do, events queued by the loop task itself are due now
+    {
+        std::lock_guard<std::mutex> lock(LedEventsMutex);
+        if (!LedEvents.empty()) return 0;
+    }
+    if (!savePending) return EventLoop::WAIT_FOREVER;
+
+    uint32_t elapsed = millis() - saveRequestTime;
+    return elapsed >= SAVE_DELAY ? 0 : SAVE_DELAY - elapsed;
+}
 
+void LEDController::begin(){
     // Initialize the LED ring
     CFastLED::addLeds<CHIPSET, LED_PIN, GRB>(LEDs, LED_COUNT);
 
-    // Retrieve variables
-    preferences.begin("storage", false);
-    currentBrightness = preferences.getUChar("brightness", DEFAULT_BRIGHTNESS);
-    uint16_t retrievedTemperature = preferences.getUShort("temperature", DEFAULT_TEMPERATURE);
-    preferences.end();
+    // Retrieve variables, from RTC memory after a warm reset or from flash after power-on
+    uint16_t retrievedTemperature;
+    uint8_t retrievedDirection;
+    uint8_t retrievedMode;
+    if (esp_reset_reason() != ESP_RST_POWERON && stateSnapshot.magic == STATE_SNAPSHOT_MAGIC) {
+        TRACELN("Loaded State from RTC memory")
+        currentBrightness = stateSnapshot.brightness;
+        retrievedTemperature = stateSnapshot.temperature;
+        retrievedDirection = stateSnapshot.direction;
+        retrievedMode = stateSnapshot.mode;
+    }
+    else {
+        TRACELN("Loaded State from flash")
+        preferences.begin("storage", false);
+        currentBrightness = preferences.getUChar("brightness", DEFAULT_BRIGHTNESS);
+        retrievedTemperature = preferences.getUShort("temperature", DEFAULT_TEMPERATURE);
+        retrievedDirection = preferences.getUChar("direction", DEFAULT_DIRECTION);
+        retrievedMode = preferences.getUChar("mode", DEFAULT_MODE);
+        preferences.end();
+    }
+
+    loadCalibration();
 
-    TRACELN("Loaded State")
     TRACE("Brightness: ")
     TRACE(currentBrightness)
     TRACE("\nTemperature: ")
     TRACE(retrievedTemperature)
+    TRACE("\nDirection: ")
+    TRACE(retrievedDirection)
+    TRACE("\nMode: ")
+    TRACE(retrievedMode)
     TRACE("\n\n")
 
     if (retrievedTemperature >= 1000 && retrievedTemperature <= 12000){
@@ -85,9 +188,25 @@ void LEDController::begin(){
         currentTemperature = DEFAULT_TEMPERATURE;
     }
 
-    currentMode = ModeBrightness;
+    currentDirection = retrievedDirection <= MAX_DIRECTION ? retrievedDirection : DEFAULT_DIRECTION;
+
+    currentMode = retrievedMode <= ModeOff ? static_cast<Mode>(retrievedMode) : ModeBrightness;
+
     setTemperature(currentTemperature);
-    setBrightness(currentBrightness);
+    if (currentDirection != 0) setDirection(currentDirection);
+    if (currentMode == ModeOff) {
+        OutputBrightness = 0;
+    }
+    else {
+        setBrightness(currentBrightness);
+    }
+
+    // Show the restored state now rather than waiting for the main loop
+    Process();
+    bootFrameTime = micros();
+
+    TRACE("Application start to first frame (us): ")
+    TRACELN(bootFrameTime)
 }
 
 void LEDController::TemperatureEvent(uint16_t kelvin) {
@@ -134,13 +253,14 @@ void LEDController::TemperatureEvent(uint16_t kelvin) {
         blue = std::min(std::max(blue, 0), 255);
     }
 
-    for(auto & led : LEDs) {
+    for(auto & led : Frame) {
         // let's set an led value
         led = CRGB(red, green, blue);
     }
 
     currentTemperature = kelvin;
-    FastLED.show();
+    renderSource = RenderTemperature;
+    render();
     saveState();
 }
 void LEDController::BrightnessEvent(uint16_t brightness){
@@ -148,8 +268,8 @@ void LEDController::BrightnessEvent(uint16_t brightness){
     TRACE(brightness)
     TRACE("\n")
     if (brightness >= 0 && brightness <= 255) {
-        FastLED.setBrightness(brightness);
-        FastLED.show();
+        OutputBrightness = brightness;
+        show();
         currentBrightness = brightness;
         saveState();
     }
@@ -161,16 +281,20 @@ void LEDController::DirectionEvent(uint16_t direction) {
     TRACE(direction)
     TRACE("\n")
 
+    if (direction > MAX_DIRECTION) {
+        return;
+    }
+
     uint8_t position;
 
     if (direction == 0){ // turn on all LEDs
-        for(auto & LED : LEDs) {
+        for(auto & LED : Frame) {
             LED = CRGB(255,255,255);
         }
     }
     else{
         // turn off all LEDs
-        for(auto & LED : LEDs) {
+        for(auto & LED : Frame) {
             // let's set an led value
             LED = CRGB(0,0,0);
         }
@@ -180,7 +304,7 @@ void LEDController::DirectionEvent(uint16_t direction) {
             // let's set an led value
             position = i + direction;
             if (position >= 26) position = position - 26;
-            LEDs[position] = CRGB(255,255,255);
+            Frame[position] = CRGB(255,255,255);
         }
         // turn on 4 outer LEDs
         for(uint8_t i = 0; i <  4; i++) {
@@ -191,56 +315,135 @@ void LEDController::DirectionEvent(uint16_t direction) {
             if (direction > 17) position += 1;
             if (direction > 21) position += 1;
             if (position < 26) position = position + 20;
-            LEDs[position] = CRGB(255,255,255);
+            Frame[position] = CRGB(255,255,255);
         }
     }
     currentDirection = static_cast<uint8_t>(direction);
-    FastLED.show();
+    renderSource = RenderDirection;
+    render();
+    saveState();
 }
 
 void LEDController::PowerEvent(bool state){
     if (state){ // turn on
         TRACELN("Power State: On")
         if (currentBrightness < 10) currentBrightness = 10;
-        FastLED.setBrightness(currentBrightness);
-        FastLED.show();
+        OutputBrightness = currentBrightness;
+        show();
         currentMode = ModeBrightness;
+        saveState();
     }
     else{ // turn off
         TRACELN("Power State: Off")
-        saveState();
-        FastLED.setBrightness(0);
-        FastLED.show();
+        OutputBrightness = 0;
+        show();
         currentMode = ModeOff;
+        saveState();
+    }
+}
+
+void LEDController::CalibrationEvent() {
+    TRACELN("Calibration updated")
+
+    uint8_t gamma;
+    {
+        // PendingGains is written by the web server task
+        std::lock_guard<std::mutex> lock(LedEventsMutex);
+        memcpy(CalibrationGains, PendingGains, sizeof(CalibrationGains));
+        gamma = PendingGamma;
+    }
+    buildGammaTable(gamma);
+
+    preferences.begin("storage", false);
+    preferences.putBytes("calgains", CalibrationGains, sizeof(CalibrationGains));
+    preferences.putUChar("calgamma", gamma);
+    preferences.end();
+
+    render();
+}
+
+void LEDController::loadCalibration() {
+    // Read the per-pixel gains and gamma from flash, falling back to an uncorrected output
+    preferences.begin("storage", true);
+    size_t length = preferences.getBytes("calgains", CalibrationGains, sizeof(CalibrationGains));
+    uint8_t gamma = preferences.getUChar("calgamma", CALIBRATION_GAMMA_LINEAR);
+    preferences.end();
+
+    if (length != sizeof(CalibrationGains)) {
+        memset(CalibrationGains, CALIBRATION_UNITY, sizeof(CalibrationGains));
+    }
+    buildGammaTable(gamma);
+}
+
+void LEDController::buildGammaTable(uint8_t gamma) {
+    if (gamma == 0) gamma = CALIBRATION_GAMMA_LINEAR;
+
+    for (uint16_t i = 0; i < 256; i++) {
+        GammaTable[i] = uint8_t(lround(255.0 * pow(i / 255.0, gamma / 10.0)));
     }
 }
 
+void LEDController::render() {
+    // Apply the calibration to the frame and show it
+    FrameLoad += applyCalibration(Frame, LEDs, CalibrationGains, GammaTable, LED_COUNT);
+    show();
+}
+
+void LEDController::show() {
+    // Send LEDs[] to the ring, scaled down if needed to stay within the power budget
+    uint8_t brightness = limitBrightness(FrameLoad, OutputBrightness, LED_COUNT, EstimatedCurrent);
+    if (brightness < OutputBrightness) {
+        TRACE("Power limited brightness: ")
+        TRACELN(brightness)
+    }
+    FastLED.setBrightness(brightness);
+    FastLED.show();
+}
+
+uint16_t LEDController::estimatedCurrent() {
+    return EstimatedCurrent;
+}
+
+void LEDController::setCalibration(const uint8_t gains[LED_COUNT][3], uint8_t gamma){
+    {
+        std::lock_guard<std::mutex> lock(LedEventsMutex);
+        memcpy(PendingGains, gains, sizeof(PendingGains));
+        PendingGamma = gamma;
+    }
+    enqueueEvent(CalibrationOperation, 0);
+}
+
 void LEDController::setTemperature(uint16_t kelvin){
-    LedEvents.emplace(TemperatureOperation, kelvin);
+    enqueueEvent(TemperatureOperation, kelvin);
 }
 
 void LEDController::setBrightness(uint16_t brightness){
-    LedEvents.emplace(BrightnessOperation, brightness);
+    enqueueEvent(BrightnessOperation, brightness);
 }
 
 void LEDController::setDirection(uint16_t direction){
-    LedEvents.emplace(DirectionOperation, direction);
+    enqueueEvent(DirectionOperation, direction);
 }
 
 void LEDController::Off(){
-    LedEvents.emplace(PowerOperation, false);
+    enqueueEvent(PowerOperation, false);
 }
 
 void LEDController::On(){
-    LedEvents.emplace(PowerOperation, true);
+    enqueueEvent(PowerOperation, true);
 }
 
 void LEDController::flashLEDs(CRGB colour) const{
     // Flash the LED ring for a short duration with a different colour
-    FastLED.showColor(colour);
+    FastLED.showColor(colour, limitBrightness((colour.r + colour.g + colour.b) * LED_COUNT, OutputBrightness, LED_COUNT, EstimatedCurrent));
     delay(MODE_FLASH_DURATION);
     setTemperature(currentTemperature);
-    setBrightness(currentBrightness);
+    if (currentMode == ModeOff) {
+        Off(); // keep the ring dark if it was restored in the off state
+    }
+    else {
+        setBrightness(currentBrightness);
+    }
 }
 
 void LEDController::showError(ErrorState error){
@@ -274,6 +477,7 @@ void LEDController::changeMode() {
         default:
             break;
     }
+    saveState();
 }
 
 void LEDController::Up(){
@@ -376,7 +580,21 @@ void LEDController::Down(){
 }
 
 void LEDController::saveState() const{
+    // Keep the RTC memory copy in step so a warm reset restores the same state
+    stateSnapshot.brightness = currentBrightness;
+    stateSnapshot.temperature = currentTemperature;
+    stateSnapshot.direction = currentDirection;
+    stateSnapshot.mode = currentMode;
+    stateSnapshot.magic = STATE_SNAPSHOT_MAGIC;
+
+    // Schedule the flash write, restarting the delay on each change
+    savePending = true;
+    saveRequestTime = millis();
+}
+
+void LEDController::commitState() const{
     // Save changed values to solid state memory
+    savePending = false;
 
     preferences.begin("storage", false);
     uint8_t savedBrightness = preferences.getUChar("brightness", DEFAULT_BRIGHTNESS);
@@ -392,5 +610,17 @@ void LEDController::saveState() const{
         TRACELN("Saved Temperature State")
     }
 
+    uint8_t savedDirection = preferences.getUChar("direction", DEFAULT_DIRECTION);
+    if (currentDirection != savedDirection) { // check if value has changed before saving to limit unnecessary writes
+        preferences.putUChar("direction", currentDirection);
+        TRACELN("Saved Direction State")
+    }
+
+    uint8_t savedMode = preferences.getUChar("mode", DEFAULT_MODE);
+    if (currentMode != savedMode) { // check if value has changed before saving to limit unnecessary writes
+        preferences.putUChar("mode", currentMode);
+        TRACELN("Saved Mode State")
+    }
+
     preferences.end();
-}
\ No newline at end of file
+}
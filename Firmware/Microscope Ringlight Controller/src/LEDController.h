@@ -2,12 +2,20 @@
 #define MICROSCOPE_RINGLIGHT_CONTROLLER_LEDCONTROLLER_H
 
 #include <FastLED.h>
+#include <atomic>
 #include <Preferences.h>
 #include "Debug.h"
+#include "RenderKernel.h"
 
 #define LED_PIN     32
 #define LED_COUNT    46
 #define CHIPSET     WS2812B
+#define MAX_DIRECTION 26 // directions are 1 to 26, 0 lights every LED
+#define EVENT_QUEUE_LIMIT 16 // web requests are refused once this many events are waiting, so bursts cannot exhaust the heap
+
+#define CALIBRATION_UNITY 255 // per channel gain that leaves a pixel unchanged
+#define CALIBRATION_GAMMA_LINEAR 10 // gamma stored as tenths, 10 = 1.0
+#define CALIBRATION_GAMMA_MAX 50 // largest gamma accepted, 5.0
 
 class LEDController {
 public:
@@ -22,13 +30,29 @@ public:
     volatile uint8_t currentDirection = 0;
     volatile uint16_t currentTemperature = 5000;
 
+    // Which of the temperature fill and the direction pattern the LEDs show, whichever was set last
+    enum RenderSource {RenderTemperature = 0, RenderDirection = 1};
+    volatile RenderSource renderSource = RenderTemperature;
+
+    // Increases every time an event changes the state
+    std::atomic<uint32_t> stateGeneration{0};
+
+    // Microseconds from application start until the restored state was first shown,
+    // not counting the ROM and second stage bootloader that run before it
+    uint32_t bootFrameTime = 0;
+
     void Process();
+    uint32_t nextDeadline() const;
+    void stateChanged();
+    static uint16_t estimatedCurrent();
     void begin();
     static void Off();
     static void On();
     static void setTemperature(uint16_t kelvin);
     static void setBrightness(uint16_t brightness);
     static void setDirection(uint16_t direction);
+    static void setCalibration(const uint8_t gains[LED_COUNT][3], uint8_t gamma);
+    static bool eventQueueFull();
     void changeMode();
     void Up();
     void Down();
@@ -39,10 +63,16 @@ private:
 
     void flashLEDs(CRGB colour) const;
     void saveState() const;
+    void commitState() const;
     void TemperatureEvent(uint16_t kelvin);
     void BrightnessEvent(uint16_t brightness);
     void DirectionEvent(uint16_t direction) ;
     void PowerEvent(bool state);
+    void CalibrationEvent();
+    static void loadCalibration();
+    static void buildGammaTable(uint8_t gamma);
+    static void render();
+    static void show();
 };
 
 #endif //MICROSCOPE_RINGLIGHT_CONTROLLER_LEDCONTROLLER_H
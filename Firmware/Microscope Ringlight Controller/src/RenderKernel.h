@@ -0,0 +1,42 @@
+#ifndef MICROSCOPE_RINGLIGHT_CONTROLLER_RENDERKERNEL_H
+#define MICROSCOPE_RINGLIGHT_CONTROLLER_RENDERKERNEL_H
+
+#include <FastLED.h>
+
+#define POWER_BUDGET_MA 1500 // most current the ring may draw from the supply
+#define LED_CHANNEL_MA 20 // current drawn by one colour channel at full output
+#define LED_IDLE_MA 1 // current drawn by each LED when dark
+
+// Final render stage: apply the per-pixel gain and shared gamma table to count pixels of frame, writing them to leds.
+// Fixed point only, so the loop stays short enough to run on every event.
+// Returns the change in the sum of every channel value in leds, used to keep the power model's load up to date.
+inline int32_t applyCalibration(const CRGB *frame, CRGB *leds, const uint8_t (*gains)[3], const uint8_t *gammaTable, uint8_t count) {
+    int32_t loadChange = 0;
+    for (uint8_t i = 0; i < count; i++) {
+        CRGB pixel(gammaTable[scale8(frame[i].r, gains[i][0])],
+                   gammaTable[scale8(frame[i].g, gains[i][1])],
+                   gammaTable[scale8(frame[i].b, gains[i][2])]);
+        loadChange += (pixel.r + pixel.g + pixel.b) - (leds[i].r + leds[i].g + leds[i].b);
+        leds[i] = pixel;
+    }
+    return loadChange;
+}
+
+// Return the highest brightness, up to the one requested, that keeps a frame within POWER_BUDGET_MA.
+// load is the sum of every channel value in the frame. The current the frame draws at the returned
+// brightness is written to estimatedCurrent, in mA.
+inline uint8_t limitBrightness(uint32_t load, uint8_t brightness, uint8_t ledCount, uint16_t &estimatedCurrent) {
+    const uint32_t idleCurrent = ledCount * LED_IDLE_MA;
+    const uint32_t available = POWER_BUDGET_MA - idleCurrent;
+    const uint32_t fullScale = 255 * 255; // channel value times brightness at full output
+    uint32_t loadCurrent = load * LED_CHANNEL_MA; // mA * fullScale at brightness 255
+
+    uint8_t limited = brightness;
+    if (loadCurrent * brightness > available * fullScale) {
+        limited = uint8_t(available * fullScale / loadCurrent);
+    }
+    estimatedCurrent = uint16_t(idleCurrent + loadCurrent * limited / fullScale);
+    return limited;
+}
+
+#endif //MICROSCOPE_RINGLIGHT_CONTROLLER_RENDERKERNEL_H
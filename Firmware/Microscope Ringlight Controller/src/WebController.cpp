@@ -1,9 +1,21 @@
 #include "WebController.h"
+#include <esp_system.h>
+#include <memory>
+
+// Held /getstate requests are answered from the response callback, which needs RESPONSE_TRY_AGAIN
+#ifndef RESPONSE_TRY_AGAIN
+#error "WebController needs a version of ESP Async WebServer that supports RESPONSE_TRY_AGAIN"
+#endif
 
 AsyncWebServer webserver(80);
 
+// Largest request bodies accepted, anything bigger is refused with 413
+const size_t MAX_CONTROL_BODY_SIZE = 128;
+const size_t MAX_CALIBRATION_BODY_SIZE = 1024;
+
 void WebController::begin(){
     // Initialize the web server
+    bootId = esp_random();
 
     // Route for root / web page
     webserver.on("/", HTTP_GET, [](AsyncWebServerRequest *request){
@@ -21,18 +33,34 @@ void WebController::begin(){
     });
 
     // GET Endpoints
+    // Returns 304 when If-None-Match matches the current state token.
+    // With ?since=<token> the request is held until the state changes, or answered with an empty
+    // body once LONG_POLL_TIMEOUT passes without a change.
     webserver.on("/getstate", HTTP_GET, [this](AsyncWebServerRequest *request) {
+        // Read the generation once, an event may change it at any time
+        uint32_t generation = ledController.stateGeneration;
+        if (request->hasParam("since") && request->getParam("since")->value() == stateToken(generation)) {
+            holdState(request, generation);
+            return;
+        }
+        sendState(request, generation);
+    });
+
+    webserver.on("/stats", HTTP_GET, [this](AsyncWebServerRequest *request) {
         // Send the response
-        request->send(200, "application/json", LightsData());
+        request->send(200, "application/json", StatsData());
     });
 
     // Route for receiving a POST request on "/power"
     webserver.on("/power", HTTP_POST, [](AsyncWebServerRequest *request) {}, nullptr, [this](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+        // Wait until the whole body has arrived
+        if (!collectBody(request, data, len, index, total, MAX_CONTROL_BODY_SIZE)) return;
+
         // Allocate the JSON document
         JsonDocument doc;
 
         // Deserialize the JSON document
-        DeserializationError error = deserializeJson(doc, (const char*)data);
+        DeserializationError error = deserializeJson(doc, (const char*)request->_tempObject);
 
         // Test if parsing succeeds
         if (error) {
@@ -42,6 +70,11 @@ void WebController::begin(){
             return;
         }
 
+        if (LEDController::eventQueueFull()) {
+            sendBusy(request);
+            return;
+        }
+
         if (doc["power"] == 1){
             if (ledController.currentMode == LEDController::ModeOff) {
                 LEDController::On();
@@ -57,11 +90,14 @@ void WebController::begin(){
 
     // Route for receiving a POST request on "/brightness"
     webserver.on("/brightness", HTTP_POST, [](AsyncWebServerRequest *request) {}, nullptr, [this](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+        // Wait until the whole body has arrived
+        if (!collectBody(request, data, len, index, total, MAX_CONTROL_BODY_SIZE)) return;
+
         // Allocate the JSON document
         JsonDocument doc;
 
         // Deserialize the JSON document
-        DeserializationError error = deserializeJson(doc, (const char*)data);
+        DeserializationError error = deserializeJson(doc, (const char*)request->_tempObject);
 
         // Test if parsing succeeds
         if (error) {
@@ -74,6 +110,10 @@ void WebController::begin(){
         uint8_t brightness = doc["brightness"];
 
         if (ledController.currentBrightness != brightness){
+            if (LEDController::eventQueueFull()) {
+                sendBusy(request);
+                return;
+            }
             LEDController::setBrightness(brightness);
         }
 
@@ -82,11 +122,14 @@ void WebController::begin(){
 
     // Route for receiving a POST request on "/temperature"
     webserver.on("/temperature", HTTP_POST, [](AsyncWebServerRequest *request) {}, nullptr, [this](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+        // Wait until the whole body has arrived
+        if (!collectBody(request, data, len, index, total, MAX_CONTROL_BODY_SIZE)) return;
+
         // Allocate the JSON document
         JsonDocument doc;
 
         // Deserialize the JSON document
-        DeserializationError error = deserializeJson(doc, (const char*)data);
+        DeserializationError error = deserializeJson(doc, (const char*)request->_tempObject);
 
         // Test if parsing succeeds
         if (error) {
@@ -99,6 +142,10 @@ void WebController::begin(){
         uint16_t temperature = doc["temperature"];
 
         if (ledController.currentTemperature != temperature){
+            if (LEDController::eventQueueFull()) {
+                sendBusy(request);
+                return;
+            }
             LEDController::setTemperature(temperature);
         }
 
@@ -107,11 +154,14 @@ void WebController::begin(){
 
     // Route for receiving a POST request on "/direction"
     webserver.on("/direction", HTTP_POST, [](AsyncWebServerRequest *request) {}, nullptr, [this](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+        // Wait until the whole body has arrived
+        if (!collectBody(request, data, len, index, total, MAX_CONTROL_BODY_SIZE)) return;
+
         // Allocate the JSON document
         JsonDocument doc;
 
         // Deserialize the JSON document
-        DeserializationError error = deserializeJson(doc, (const char*)data);
+        DeserializationError error = deserializeJson(doc, (const char*)request->_tempObject);
 
         // Test if parsing succeeds
         if (error) {
@@ -121,15 +171,119 @@ void WebController::begin(){
             return;
         }
 
+        // Direction must be a whole number from 0 to MAX_DIRECTION
+        if (!doc["direction"].is<uint8_t>() || doc["direction"].as<uint8_t>() > MAX_DIRECTION) {
+            request->send(400, "application/json", R"({"message":"failed"})");
+            return;
+        }
         uint8_t direction = doc["direction"];
 
         if (ledController.currentDirection != direction){
+            if (LEDController::eventQueueFull()) {
+                sendBusy(request);
+                return;
+            }
             LEDController::setDirection(direction);
         }
 
         request->send(200, "application/json", R"({"message":"success"})");
     });
 
+    // Route for receiving a POST request on "/calibration"
+    // Body: {"gains":[[r,g,b], ...one entry per LED...], "gamma":22}
+    webserver.on("/calibration", HTTP_POST, [](AsyncWebServerRequest *request) {}, nullptr, [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+        // Wait until the whole body has arrived
+        if (!collectBody(request, data, len, index, total, MAX_CALIBRATION_BODY_SIZE)) return;
+
+        // Allocate the JSON document
+        JsonDocument doc;
+
+        // Deserialize the JSON document
+        DeserializationError error = deserializeJson(doc, (const char*)request->_tempObject);
+
+        // Test if parsing succeeds
+        if (error) {
+            TRACELN(F("deserializeJson() failed: "))
+            TRACELN(error.f_str())
+            request->send(400, "application/json", R"({"message":"failed"})");
+            return;
+        }
+
+        JsonArray gainsArray = doc["gains"];
+        if (gainsArray.size() != LED_COUNT) {
+            request->send(400, "application/json", R"({"message":"failed"})");
+            return;
+        }
+
+        uint8_t gains[LED_COUNT][3];
+        uint8_t i = 0;
+        for (JsonArray pixel : gainsArray) {
+            // Each gain must be a whole number from 0 to 255
+            if (pixel.size() != 3 || !pixel[0].is<uint8_t>() || !pixel[1].is<uint8_t>() || !pixel[2].is<uint8_t>()) {
+                request->send(400, "application/json", R"({"message":"failed"})");
+                return;
+            }
+            gains[i][0] = pixel[0];
+            gains[i][1] = pixel[1];
+            gains[i][2] = pixel[2];
+            i++;
+        }
+
+        // Gamma is optional, in tenths from 0.1 to CALIBRATION_GAMMA_MAX
+        uint8_t gamma = CALIBRATION_GAMMA_LINEAR;
+        if (!doc["gamma"].isNull()) {
+            if (!doc["gamma"].is<uint8_t>()) {
+                request->send(400, "application/json", R"({"message":"failed"})");
+                return;
+            }
+            gamma = doc["gamma"];
+        }
+        if (gamma == 0 || gamma > CALIBRATION_GAMMA_MAX) {
+            request->send(400, "application/json", R"({"message":"failed"})");
+            return;
+        }
+
+        if (LEDController::eventQueueFull()) {
+            sendBusy(request);
+            return;
+        }
+        LEDController::setCalibration(gains, gamma);
+
+        request->send(200, "application/json", R"({"message":"success"})");
+    });
+
+    // Route for receiving a POST request on "/group"
+    // Body: {"role":0,"group":1} where role 0 = off, 1 = leader, 2 = member
+    webserver.on("/group", HTTP_POST, [](AsyncWebServerRequest *request) {}, nullptr, [this](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+        // Wait until the whole body has arrived
+        if (!collectBody(request, data, len, index, total, MAX_CONTROL_BODY_SIZE)) return;
+
+        // Allocate the JSON document
+        JsonDocument doc;
+
+        // Deserialize the JSON document
+        DeserializationError error = deserializeJson(doc, (const char*)request->_tempObject);
+
+        // Test if parsing succeeds
+        if (error) {
+            TRACELN(F("deserializeJson() failed: "))
+            TRACELN(error.f_str())
+            request->send(400, "application/json", R"({"message":"failed"})");
+            return;
+        }
+
+        uint8_t role = doc["role"];
+        uint8_t group = doc["group"];
+        if (role > GroupController::RoleMember) {
+            request->send(400, "application/json", R"({"message":"failed"})");
+            return;
+        }
+
+        groupController.setRole(static_cast<GroupController::Role>(role), group);
+
+        request->send(200, "application/json", R"({"message":"success"})");
+    });
+
     webserver.onNotFound(notFound);
     webserver.begin();
 }
@@ -138,11 +292,108 @@ void WebController::notFound(AsyncWebServerRequest *request) {
     request->send(404, "text/plain", "Not found");
 }
 
-String WebController::LightsData() const {
+bool WebController::collectBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total, size_t maxSize) {
+    // Assemble a request body that may arrive in several chunks.
+    // Returns true once the complete, null terminated body is in request->_tempObject,
+    // which the web server frees when the request is finished.
+    if (total > maxSize) {
+        if (index == 0) {
+            request->send(413, "application/json", R"({"message":"failed"})");
+        }
+        return false;
+    }
+
+    if (index == 0) {
+        request->_tempObject = malloc(total + 1);
+        if (request->_tempObject == nullptr) {
+            sendBusy(request);
+            return false;
+        }
+    }
+    else if (request->_tempObject == nullptr) {
+        return false; // the first chunk was refused
+    }
+
+    auto *body = static_cast<uint8_t*>(request->_tempObject);
+    memcpy(body + index, data, len);
+
+    if (index + len < total) {
+        return false; // more chunks to come
+    }
+    body[total] = 0;
+    return true;
+}
+
+void WebController::sendBusy(AsyncWebServerRequest *request) {
+    // Ask the client to back off while the LED event queue drains
+    AsyncWebServerResponse *response = request->beginResponse(429, "application/json", R"({"message":"busy"})");
+    response->addHeader("Retry-After", "1");
+    request->send(response);
+}
+
+String WebController::stateToken(uint32_t generation) const {
+    // Identifies a state uniquely across reboots, used as the ETag and the long-poll since value
+    return String(bootId, HEX) + "-" + String(generation);
+}
+
+void WebController::holdState(AsyncWebServerRequest *request, uint32_t since) {
+    // Answer once the state differs from generation since, or after LONG_POLL_TIMEOUT with an
+    // empty body, which tells the client to ask again with the same token.
+    // The response callback runs on the web server task: it is called when the response starts
+    // and again each time the server polls the connection, about every 500ms, and returns
+    // RESPONSE_TRY_AGAIN until there is something to send. No other task touches the request.
+    if (longPolls >= MAX_LONG_POLLS) {
+        sendBusy(request);
+        return;
+    }
+    longPolls++;
+    request->onDisconnect([this]() {
+        longPolls--;
+    });
+
+    uint32_t startTime = millis();
+    auto body = std::make_shared<String>();
+
+    AsyncWebServerResponse *response = request->beginChunkedResponse("application/json", [this, since, startTime, body](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+        if (index == 0 && body->length() == 0) {
+            uint32_t generation = ledController.stateGeneration;
+            if (generation == since) {
+                return millis() - startTime < LONG_POLL_TIMEOUT ? RESPONSE_TRY_AGAIN : 0;
+            }
+            *body = LightsData(generation);
+        }
+
+        if (index >= body->length()) return 0;
+        size_t length = std::min(maxLen, body->length() - index);
+        memcpy(buffer, body->c_str() + index, length);
+        return length;
+    });
+    response->addHeader("Cache-Control", "no-cache");
+    request->send(response);
+}
+
+void WebController::sendState(AsyncWebServerRequest *request, uint32_t generation) {
+    // Send the state at generation, or 304 if the client already has it
+    String etag = "\"" + stateToken(generation) + "\"";
+
+    AsyncWebServerResponse *response;
+    if (request->hasHeader("If-None-Match") && request->getHeader("If-None-Match")->value() == etag) {
+        response = request->beginResponse(304);
+    }
+    else {
+        response = request->beginResponse(200, "application/json", LightsData(generation));
+    }
+    response->addHeader("ETag", etag);
+    response->addHeader("Cache-Control", "no-cache");
+    request->send(response);
+}
+
+String WebController::LightsData(uint32_t generation) const {
     /// Allocate the JSON document with a specific size
     JsonDocument doc;
 
     doc["numberOfLights"] = 26;
+    doc["generation"] = stateToken(generation); // changes whenever the state changes
     // Create the lights array
     JsonArray lights = doc["lights"].to<JsonArray>();
 
@@ -157,6 +408,10 @@ String WebController::LightsData() const {
     light["temperature"] = ledController.currentTemperature;  // Color temperature
     light["direction"] = ledController.currentDirection;  // Direction
 
+    JsonObject group = doc["group"].to<JsonObject>();
+    group["role"] = groupController.role;  // 0 = off, 1 = leader, 2 = member
+    group["group"] = groupController.group;  // Group number
+
     // Serialize JSON document to String
     String response;
     serializeJson(doc, response);
@@ -164,4 +419,18 @@ String WebController::LightsData() const {
     return response;
 }
 
+String WebController::StatsData() const {
+    // Allocate the JSON document
+    JsonDocument doc;
+
+    doc["bootTime"] = ledController.bootFrameTime; // microseconds from application start to the first frame
+    doc["wakes"] = EventLoop::wakeCount(); // number of times the main loop has been woken
+    doc["loopIdle"] = EventLoop::loopIdlePercent(); // percentage of time the main loop task has been blocked, not CPU idle
+    doc["current"] = LEDController::estimatedCurrent(); // estimated mA drawn by the ring
 
+    // Serialize JSON document to String
+    String response;
+    serializeJson(doc, response);
+
+    return response;
+}
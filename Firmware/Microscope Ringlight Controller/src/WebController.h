@@ -6,17 +6,32 @@
 #include <AsyncTCP.h>
 #include "SPIFFS.h"
 #include "LEDController.h"
+#include "GroupController.h"
+#include "EventLoop.h"
 #include "Debug.h"
 
 class WebController {
 public:
-    // Constructor that initializes the ledController reference
-    explicit WebController(LEDController& controller) : ledController(controller) {}
+    // Constructor that initializes the ledController and groupController references
+    WebController(LEDController& controller, GroupController& group) : ledController(controller), groupController(group) {}
     void begin();
+
+    static const uint32_t LONG_POLL_TIMEOUT = 20000; // longest time a /getstate?since= request is held, 20s
 private:
+    static const uint8_t MAX_LONG_POLLS = 4;
+
     LEDController& ledController; // Declare a reference to LEDController
+    GroupController& groupController; // Declare a reference to GroupController
+    uint32_t bootId = 0; // random number chosen at startup so state tokens from an earlier boot never match
+    uint8_t longPolls = 0; // /getstate?since= requests being held, only used on the web server task
     static void notFound(AsyncWebServerRequest *request);
-    String LightsData() const;
+    static bool collectBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total, size_t maxSize);
+    static void sendBusy(AsyncWebServerRequest *request);
+    String LightsData(uint32_t generation) const;
+    String stateToken(uint32_t generation) const;
+    void sendState(AsyncWebServerRequest *request, uint32_t generation);
+    void holdState(AsyncWebServerRequest *request, uint32_t since);
+    String StatsData() const;
 };
 
 
@@ -2,6 +2,8 @@
 #include <WiFi.h>
 #include "LEDController.h"
 #include "WebController.h"
+#include "GroupController.h"
+#include "EventLoop.h"
 #include <ESPmDNS.h>
 #include "Debug.h"
 #include "SPIFFS.h"
@@ -16,6 +18,7 @@ const uint8_t ENCODER_B_PIN = 26; // ESP32 pin GPIO26 connected to encoder pin B
 const uint8_t ENCODER_SWITCH_PIN = 27; // ESP32 pin GPIO27 connected to encoder switch
 static volatile uint64_t encoderLastSwitchTime = 0;
 static volatile uint64_t encoderSwitchStartTime = 0;
+const uint32_t ENCODER_LONG_PRESS_TIME = 2000; // hold the switch for 2s to turn the light on or off
 
 enum EncoderStates{Stationary, CounterClockwise, Clockwise};
 static volatile EncoderStates encoderRotationFlag = Stationary; // signals a change in the encoder rotation
@@ -26,8 +29,19 @@ static volatile bool encoderSwitchLongPressedFlag = false; // signals a switch l
 // Information about the web server
 const char* HOST_NAME = "microscope";
 
+// Information about the Wi-Fi connection
+const uint32_t WIFI_CONNECT_TIMEOUT = 10000; // give up on a connection attempt after 10s
+const uint32_t WIFI_RETRY_DELAY = 5000; // wait 5s before trying to connect again
+enum WifiStates{WifiConnecting, WifiConnected, WifiWaitRetry};
+static WifiStates wifiState = WifiConnecting;
+static uint32_t wifiStateTime = 0; // time the current Wi-Fi state was entered
+static bool wifiErrorShown = false; // only flash the Wi-Fi error once
+static bool servicesStarted = false; // mDNS and web server are started on the first connection
+static bool storageFailed = false; // SPIFFS could not be mounted
+
 LEDController ledController;
-WebController webController(ledController);
+GroupController groupController(ledController);
+WebController webController(ledController, groupController);
 
 const char* ssid = "wifissid";
 const char* password = "wifipassword";
@@ -47,6 +61,7 @@ void IRAM_ATTR ISR_encoder_rotation() {
             encoderRotationFlag = Clockwise;
         }
     }
+    EventLoop::wakeFromISR();
 }
 
 void IRAM_ATTR ISR_encoder_switch() {
@@ -55,6 +70,7 @@ void IRAM_ATTR ISR_encoder_switch() {
     }
     encoderSwitchChangeStateFlag = true;
     encoderLastSwitchTime = millis();
+    EventLoop::wakeFromISR();
 }
 
 void setup() {
@@ -75,7 +91,7 @@ void setup() {
 
     digitalWrite(LED_D1, HIGH); // Set D1 Led high to show the device is powered
 
-    bool failed = false; // flag for checking if setup completes successfully
+    EventLoop::begin(); // loop() sleeps until an interrupt, web request or timer wakes it
 
     // call ISR_encoder() when CLK pin changes from LOW to HIGH
     attachInterrupt(digitalPinToInterrupt(ENCODER_B_PIN), ISR_encoder_rotation, RISING);
@@ -83,33 +99,33 @@ void setup() {
     // call ISR_encoder() when CLK pin changes from HIGH to LOW
     attachInterrupt(digitalPinToInterrupt(ENCODER_SWITCH_PIN), ISR_encoder_switch, CHANGE);
 
-    ledController.begin(); // Initialize the LED controller object
+    ledController.begin(); // Initialize the LED controller object and show the saved state
 
     // Initialize SPIFFS
     if(!SPIFFS.begin(true)){
         TRACE("An Error has occurred while mounting SPIFFS")
-        failed = true;
+        storageFailed = true;
+        digitalWrite(LED_D2, HIGH); // Set D2 LED high to show an error has occurred.
         ledController.showError(LEDController::ErrorFlashMem);
     }
 
-    // Initialize the Wi-Fi module
+    // Start connecting to Wi-Fi, the connection is completed in the background by serviceWifi()
     WiFiClass::mode(WIFI_STA);
-
     WiFiClass::setHostname(HOST_NAME);
+    WiFi.setAutoReconnect(false); // reconnection is handled by serviceWifi()
+    WiFi.onEvent([](WiFiEvent_t event, WiFiEventInfo_t info) {
+        EventLoop::wake(); // let serviceWifi() react to connection changes straight away
+    });
     WiFi.begin(ssid, password);
-    if (WiFi.waitForConnectResult() != WL_CONNECTED) {
-        TRACE("WiFi Failed!\n")
-        failed = true;
-        ledController.showError(LEDController::ErrorNoWifi);
-    }
-    else{ // Wi-Fi connected
-        TRACE("IP Address: ")
-        TRACELN(WiFi.localIP())
-    }
+    wifiState = WifiConnecting;
+    wifiStateTime = millis();
+}
 
+void startServices() {
+    // Start mDNS and the web server once the first Wi-Fi connection is made
     if(!MDNS.begin(HOST_NAME)) {
         TRACELN("Error starting mDNS")
-        failed = true;
+        digitalWrite(LED_D2, HIGH); // Set D2 LED high to show an error has occurred.
         ledController.showError(LEDController::ErrorGeneralException);
     }
     else{
@@ -117,12 +133,72 @@ void setup() {
         MDNS.addService("http", "tcp", 80);
     }
 
-    if (failed) {
-        digitalWrite(LED_D2, HIGH); // Set D2 LED high to show an error has occurred.
-    }
-    else{
+    groupController.begin();
+
+    if (!storageFailed) {
         webController.begin();
     }
+    servicesStarted = true;
+}
+
+void serviceWifi() {
+    // Wi-Fi connection state machine, called from loop()
+    switch (wifiState) {
+        case WifiConnecting:
+            if (WiFi.status() == WL_CONNECTED) {
+                TRACE("IP Address: ")
+                TRACELN(WiFi.localIP())
+                if (!storageFailed) {
+                    digitalWrite(LED_D2, LOW); // clear any earlier Wi-Fi error
+                }
+                if (!servicesStarted) {
+                    startServices();
+                }
+                wifiState = WifiConnected;
+                wifiStateTime = millis();
+            }
+            else if (millis() - wifiStateTime > WIFI_CONNECT_TIMEOUT) {
+                TRACE("WiFi Failed!\n")
+                digitalWrite(LED_D2, HIGH); // Set D2 LED high to show an error has occurred.
+                if (!wifiErrorShown) {
+                    ledController.showError(LEDController::ErrorNoWifi);
+                    wifiErrorShown = true;
+                }
+                WiFi.disconnect();
+                wifiState = WifiWaitRetry;
+                wifiStateTime = millis();
+            }
+            break;
+        case WifiConnected:
+            if (WiFi.status() != WL_CONNECTED) {
+                TRACELN("WiFi connection lost")
+                WiFi.disconnect();
+                wifiState = WifiWaitRetry;
+                wifiStateTime = millis();
+            }
+            break;
+        case WifiWaitRetry:
+            if (millis() - wifiStateTime > WIFI_RETRY_DELAY) {
+                TRACELN("WiFi reconnecting")
+                WiFi.begin(ssid, password);
+                wifiState = WifiConnecting;
+                wifiStateTime = millis();
+            }
+            break;
+    }
+}
+
+uint32_t wifiDeadline() {
+    // Milliseconds until serviceWifi() needs to run again
+    uint32_t elapsed = millis() - wifiStateTime;
+    switch (wifiState) {
+        case WifiConnecting:
+            return elapsed >= WIFI_CONNECT_TIMEOUT ? 0 : WIFI_CONNECT_TIMEOUT - elapsed;
+        case WifiWaitRetry:
+            return elapsed >= WIFI_RETRY_DELAY ? 0 : WIFI_RETRY_DELAY - elapsed;
+        default:
+            return EventLoop::WAIT_FOREVER; // connection loss is signalled by a Wi-Fi event
+    }
 }
 
 void loop() {
@@ -150,7 +226,7 @@ void loop() {
     }
 
     if (encoderSwitchPressedFlag){
-        if (millis() - encoderSwitchStartTime > 2000){ // button pressed for more than 2 seconds
+        if (millis() - encoderSwitchStartTime > ENCODER_LONG_PRESS_TIME){ // button pressed for more than 2 seconds
             TRACELN("Long press")
             if (ledController.currentMode == LEDController::ModeOff) {
                 LEDController::On();
@@ -175,4 +251,19 @@ void loop() {
     }
 
     ledController.Process(); // process the next event in the LED operations queue
+
+    groupController.Process(); // send or apply group state frames
+
+    serviceWifi();
+
+    // Sleep until woken by an interrupt or web request, or until the nearest pending timer
+    uint32_t timeout = std::min({ledController.nextDeadline(), groupController.nextDeadline(), wifiDeadline()});
+    if (encoderSwitchPressedFlag) {
+        uint32_t held = millis() - encoderSwitchStartTime;
+        timeout = std::min(timeout, held >= ENCODER_LONG_PRESS_TIME ? 0 : ENCODER_LONG_PRESS_TIME - held + 1);
+    }
+    if (encoderSwitchChangeStateFlag || encoderRotationFlag != Stationary) {
+        timeout = 0; // input arrived while this pass was running
+    }
+    EventLoop::wait(timeout);
 }
\ No newline at end of file
@@ -0,0 +1,457 @@
+// Measures the firmware hot paths on the host, running the real LEDController and WebController
+// against the simulated hardware in stubs/.
+// Reports time, heap allocations and bytes allocated per operation for each path and scenario, and
+// fails when a path is slower or allocates more bytes than benchmark_baseline.txt by more than the
+// threshold, or makes more allocations at all, and when a path and the baseline do not list the same paths.
+// Times are compared relative to a fixed reference workload, and a path that looks slower is given
+// more rounds before it is reported.
+//
+//   firmware_benchmark <baseline file> [threshold percent]   compare with the baseline, default 50%
+//   firmware_benchmark --update <baseline file>              write the baseline from this run
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "LEDController.h"
+#include "EventLoop.h"
+#include "WebController.h"
+#include "heap_counter.h"
+
+const char *const REFERENCE_PATH = "reference";
+const int REPETITIONS = 15; // the fastest run of each path is kept, heap use is taken from the last
+const int RETRIES = 6;      // further sets of rounds run while a path still looks slower than its baseline
+
+// Accumulates the time and heap use of the measured part of each operation
+class Stopwatch {
+public:
+    void start() {
+        countAllocations = true;
+        startTime = std::chrono::steady_clock::now();
+    }
+
+    void stop() {
+        elapsed += std::chrono::steady_clock::now() - startTime;
+        countAllocations = false;
+    }
+
+    double nanoseconds() const {
+        return std::chrono::duration<double, std::nano>(elapsed).count();
+    }
+
+private:
+    std::chrono::steady_clock::time_point startTime;
+    std::chrono::steady_clock::duration elapsed{0};
+};
+
+struct Result {
+    std::string name;
+    double nanoseconds;
+    double allocations;
+    double bytes;
+};
+
+// A path is run once per round, interleaved with the others, so a burst of load on the
+// machine slows one repetition of many paths rather than every repetition of one
+struct Path {
+    Result result;
+    uint32_t operations;
+    std::function<void(Stopwatch &stopwatch)> run; // runs all the operations once
+    double relative = 0; // fewest reference runs' worth of time taken in any round
+};
+
+static std::vector<Path> paths;
+static int failures = 0;
+
+static void check(bool condition, const char *message) {
+    if (!condition) {
+        printf("FAIL: %s\n", message);
+        failures++;
+    }
+}
+
+static void addPath(const char *name, uint32_t operations, std::function<void(Stopwatch &stopwatch)> run) {
+    Path path;
+    path.result.name = name;
+    path.operations = operations;
+    path.run = std::move(run);
+    paths.push_back(std::move(path));
+}
+
+// Add a path timed over a whole run of operations, for paths too quick to time one at a time
+template <typename Operation>
+static void addPath(const char *name, uint32_t operations, Operation operation) {
+    addPath(name, operations, std::function<void(Stopwatch &)>([operations, operation](Stopwatch &stopwatch) mutable {
+        stopwatch.start();
+        for (uint32_t i = 0; i < operations; i++) operation(i);
+        stopwatch.stop();
+    }));
+}
+
+// Add a path that times only the part of each operation between stopwatch.start() and
+// stopwatch.stop(), leaving out the setup done by the simulation
+template <typename Operation>
+static void addPathWithSetup(const char *name, uint32_t operations, Operation operation) {
+    addPath(name, operations, std::function<void(Stopwatch &)>([operations, operation](Stopwatch &stopwatch) mutable {
+        for (uint32_t i = 0; i < operations; i++) operation(i, stopwatch);
+    }));
+}
+
+static LEDController ledController;
+static GroupController groupController(ledController);
+static WebController webController(ledController, groupController);
+extern AsyncWebServer webserver;
+static AsyncWebServerRequest request;
+
+static void settle() {
+    // Put the simulation in the same state before every run of a path: on, in brightness mode,
+    // no queued events and nothing waiting to be written to flash. The generation is reset so state
+    // tokens keep the same length, and so the same heap use, however many rounds have run.
+    LEDController::On();
+    LEDController::setBrightness(200);
+    LEDController::setTemperature(5000);
+    LEDController::setDirection(0);
+    ledController.Process();
+    SimulatedMillis += ledController.nextDeadline();
+    ledController.Process();
+    ledController.stateGeneration = 0;
+}
+
+static void runPaths() {
+    // The reference is the first path, so each round's times can be taken relative to it. A path's
+    // time is its best ratio over all the rounds run so far, in nanoseconds of the reference's
+    // fastest round. The first round of each call warms caches and lets containers reach their
+    // steady size, it is not recorded.
+    static int recordedRounds = 0;
+    double referenceNanoseconds = 0;
+    for (int round = 0; round <= REPETITIONS; round++) {
+        if (round > 0) recordedRounds++;
+        for (Path &path : paths) {
+            settle();
+            allocations = 0;
+            allocatedBytes = 0;
+            Stopwatch stopwatch;
+            path.run(stopwatch);
+            if (round == 0) continue;
+
+            double nanoseconds = stopwatch.nanoseconds() / path.operations;
+            if (&path == &paths[0]) {
+                referenceNanoseconds = nanoseconds;
+                if (recordedRounds == 1 || nanoseconds < path.result.nanoseconds) path.result.nanoseconds = nanoseconds;
+            }
+            double relative = nanoseconds / referenceNanoseconds;
+            if (recordedRounds == 1 || relative < path.relative) path.relative = relative;
+            path.result.allocations = double(allocations) / path.operations;
+            path.result.bytes = double(allocatedBytes) / path.operations;
+        }
+    }
+
+    for (Path &path : paths) {
+        path.result.nanoseconds = path.relative * paths[0].result.nanoseconds;
+    }
+}
+
+static uint16_t temperatureStep(uint32_t i) {
+    return 1000 + 200 * (i % 56); // 1000K to 12000K in the encoder's steps
+}
+
+static CRGB renderFrame[LED_COUNT];
+static CRGB renderLEDs[LED_COUNT];
+static uint8_t renderGains[LED_COUNT][3];
+static uint8_t renderGammaTable[256];
+static volatile int32_t renderLoad = 0;
+static volatile uint8_t limitedBrightness = 0;
+
+// Fixed table and heap work that stands for the speed of the machine. Baseline times are scaled by how
+// much faster or slower it ran than when the baseline was written, so the baseline carries between
+// machines and a slow spell on a shared one does not read as a regression.
+static uint8_t referenceTable[256];
+static volatile uint32_t referenceSum = 0;
+static char *volatile referenceBlock = nullptr;
+
+static void addReferencePath() {
+    for (uint16_t i = 0; i < 256; i++) referenceTable[i] = uint8_t(i * 167 + 13);
+    addPath(REFERENCE_PATH, 20000, [](uint32_t i) {
+        uint32_t sum = 0;
+        for (uint8_t j = 0; j < 64; j++) sum += referenceTable[uint8_t(referenceTable[uint8_t(i + j)] * 3 + j)];
+        referenceSum = referenceSum + sum;
+
+        // Web paths spend much of their time in the allocator, which slows differently from plain code
+        for (size_t size : {24, 48, 160}) {
+            referenceBlock = static_cast<char*>(malloc(size));
+            referenceBlock[size - 1] = char(sum);
+            free(referenceBlock);
+        }
+    });
+}
+
+static void addRenderPaths() {
+    for (uint16_t i = 0; i < 256; i++) renderGammaTable[i] = uint8_t((i * i) / 255);
+    for (uint8_t i = 0; i < LED_COUNT; i++) {
+        renderFrame[i] = CRGB(i * 5, 255 - i * 5, i * 3);
+        renderGains[i][0] = 250;
+        renderGains[i][1] = 240;
+        renderGains[i][2] = 230;
+    }
+
+    addPath("render.applyCalibration", 20000, [](uint32_t i) {
+        renderFrame[i % LED_COUNT].r = uint8_t(i); // change the frame so the work cannot be hoisted
+        renderLoad = renderLoad + applyCalibration(renderFrame, renderLEDs, renderGains, renderGammaTable, LED_COUNT);
+    });
+
+    addPath("render.limitBrightness", 200000, [](uint32_t i) {
+        uint16_t current;
+        limitedBrightness = limitBrightness(i * 97 % (LED_COUNT * 765 + 1), uint8_t(i), LED_COUNT, current);
+    });
+}
+
+static void addEventPaths() {
+    addPath("event.brightness", 2000, [](uint32_t i) {
+        LEDController::setBrightness(i % 2 ? 100 : 200);
+        ledController.Process();
+    });
+
+    addPath("event.temperature", 2000, [](uint32_t i) {
+        LEDController::setTemperature(temperatureStep(i));
+        ledController.Process();
+    });
+
+    addPath("event.direction", 2000, [](uint32_t i) {
+        LEDController::setDirection(i % (MAX_DIRECTION + 1));
+        ledController.Process();
+    });
+
+    // One encoder detent in each mode, without the event it queues
+    addPathWithSetup("encoder.step", 3000, [](uint32_t i, Stopwatch &stopwatch) {
+        const LEDController::Mode modes[] = {LEDController::ModeBrightness, LEDController::ModeTemperature, LEDController::ModeDirection};
+        ledController.currentMode = modes[(i / 2) % 3];
+        stopwatch.start();
+        if (i % 2) ledController.Up();
+        else ledController.Down();
+        stopwatch.stop();
+        ledController.Process();
+    });
+
+    // The debounced flash write, once SAVE_DELAY has passed since the last change
+    addPathWithSetup("state.commit", 500, [](uint32_t i, Stopwatch &stopwatch) {
+        LEDController::setBrightness(i % 2 ? 200 : 100);
+        ledController.Process();
+        SimulatedMillis += ledController.nextDeadline();
+        uint32_t writes = Preferences::writes;
+        stopwatch.start();
+        ledController.Process();
+        stopwatch.stop();
+        check(Preferences::writes == writes + 1, "a commit should write only the changed brightness");
+        check(ledController.nextDeadline() == EventLoop::WAIT_FOREVER, "a save is still pending after the commit");
+    });
+
+    // Fast spins deliver several detents between passes of the main loop
+    addPath("scenario.encoder_spin", 240, [](uint32_t i) {
+        ledController.currentMode = i < 120 ? LEDController::ModeBrightness : LEDController::ModeTemperature;
+        if ((i / 60) % 2 == 0) ledController.Up();
+        else ledController.Down();
+        if (i % 3 == 2) ledController.Process();
+    });
+}
+
+static void addPostPath(const char *name, const char *url, const char *key, uint16_t (*value)(uint32_t)) {
+    addPathWithSetup(name, 1000, [url, key, value](uint32_t i, Stopwatch &stopwatch) {
+        char body[64];
+        snprintf(body, sizeof(body), "{\"%s\":%u}", key, value(i));
+        request.reset(HTTP_POST, url, body);
+        stopwatch.start();
+        webserver.handle(&request);
+        stopwatch.stop();
+        check(request.response.code == 200, "POST was not accepted");
+        ledController.Process();
+    });
+}
+
+static void addWebPaths() {
+    addPathWithSetup("web.getstate", 2000, [](uint32_t i, Stopwatch &stopwatch) {
+        request.reset(HTTP_GET, "/getstate");
+        stopwatch.start();
+        webserver.handle(&request);
+        stopwatch.stop();
+        check(request.response.code == 200 && request.sentLength > 0, "/getstate did not send the state");
+    });
+
+    addPathWithSetup("web.getstate.not_modified", 2000, [](uint32_t i, Stopwatch &stopwatch) {
+        static std::string etag;
+        if (i == 0) {
+            request.reset(HTTP_GET, "/getstate");
+            webserver.handle(&request);
+            etag = request.response.header("ETag")->c_str();
+        }
+        request.reset(HTTP_GET, "/getstate");
+        request.addHeader("If-None-Match", etag.c_str());
+        stopwatch.start();
+        webserver.handle(&request);
+        stopwatch.stop();
+        check(request.response.code == 304, "/getstate with a current ETag was not 304");
+    });
+
+    addPostPath("web.post.power", "/power", "power", [](uint32_t i) -> uint16_t { return i % 2; });
+    addPostPath("web.post.brightness", "/brightness", "brightness", [](uint32_t i) -> uint16_t { return i % 2 ? 100 : 200; });
+    addPostPath("web.post.temperature", "/temperature", "temperature", temperatureStep);
+    addPostPath("web.post.direction", "/direction", "direction", [](uint32_t i) -> uint16_t { return i % (MAX_DIRECTION + 1); });
+
+    // A slider drag posts faster than the main loop runs, so changes merge in the event queue
+    addPathWithSetup("scenario.slider_drag", 510, [](uint32_t i, Stopwatch &stopwatch) {
+        char body[64];
+        snprintf(body, sizeof(body), "{\"brightness\":%u}", i < 255 ? i : 509 - i);
+        request.reset(HTTP_POST, "/brightness", body);
+        stopwatch.start();
+        webserver.handle(&request);
+        if (i % 4 == 3) ledController.Process();
+        stopwatch.stop();
+        check(request.response.code == 200, "slider POST was not accepted");
+    });
+
+    // Ten open pages polling /getstate with their last ETag while the state changes now and then
+    addPathWithSetup("scenario.ten_clients", 1000, [](uint32_t i, Stopwatch &stopwatch) {
+        static std::string etags[10];
+        uint32_t client = i % 10;
+        request.reset(HTTP_GET, "/getstate");
+        if (i >= 10) request.addHeader("If-None-Match", etags[client].c_str());
+        stopwatch.start();
+        if (client == 0 && i % 50 == 0) {
+            LEDController::setBrightness(i % 100 ? 100 : 200);
+            ledController.Process();
+        }
+        webserver.handle(&request);
+        stopwatch.stop();
+        check(request.response.code == 200 || request.response.code == 304, "/getstate failed");
+        etags[client] = request.response.header("ETag")->c_str();
+    });
+}
+
+static std::map<std::string, Result> readBaseline(const char *path) {
+    std::map<std::string, Result> baseline;
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        std::istringstream fields(line);
+        Result result;
+        if (fields >> result.name >> result.nanoseconds >> result.allocations >> result.bytes) {
+            baseline[result.name] = result;
+        }
+    }
+    return baseline;
+}
+
+static bool writeBaseline(const char *path) {
+    FILE *file = fopen(path, "w");
+    if (file == nullptr) return false;
+    fprintf(file, "# Firmware hot path baseline, written by firmware_benchmark --update\n");
+    fprintf(file, "# path ns/op allocations/op bytes/op, times are relative to the reference path\n");
+    for (const Path &path : paths) {
+        const Result &result = path.result;
+        fprintf(file, "%s %.1f %.2f %.1f\n", result.name.c_str(), result.nanoseconds, result.allocations, result.bytes);
+    }
+    return fclose(file) == 0;
+}
+
+// Compare every path with its baseline entry, printing the table when asked to, and return the
+// number of paths that regressed or are missing from one side
+static int compareWithBaseline(std::map<std::string, Result> baseline, double threshold, bool print) {
+    double limit = 1 + threshold / 100;
+    int regressions = 0;
+
+    double speed = 1;
+    auto reference = baseline.find(REFERENCE_PATH);
+    if (reference != baseline.end()) {
+        speed = paths[0].result.nanoseconds / reference->second.nanoseconds;
+        if (print) printf("This machine took %.2f times as long as the baseline for the reference work\n", speed);
+    }
+
+    if (print) printf("%-28s %10s %10s %10s   %-30s\n", "path", "ns/op", "allocs/op", "bytes/op", "baseline ns, allocs, bytes");
+    for (const Path &path : paths) {
+        const Result &result = path.result;
+        if (result.name == REFERENCE_PATH) continue;
+        if (print) printf("%-28s %10.1f %10.2f %10.1f   ", result.name.c_str(), result.nanoseconds, result.allocations, result.bytes);
+
+        auto entry = baseline.find(result.name);
+        if (entry == baseline.end()) {
+            if (print) printf("REGRESSED no baseline, record one with --update\n");
+            regressions++;
+            continue;
+        }
+        const Result base = entry->second;
+        baseline.erase(entry);
+        if (print) printf("%10.1f %8.2f %8.1f", base.nanoseconds * speed, base.allocations, base.bytes);
+
+        // Allocation counts do not depend on the machine, so any increase is a regression
+        bool slower = result.nanoseconds > base.nanoseconds * speed * limit;
+        bool moreAllocations = result.allocations > base.allocations + 0.005;
+        bool moreBytes = result.bytes > base.bytes * limit + 0.05;
+        if (slower || moreAllocations || moreBytes) {
+            if (print) printf("  REGRESSED%s%s%s\n", slower ? " time" : "", moreAllocations ? " allocations" : "", moreBytes ? " bytes" : "");
+            regressions++;
+        }
+        else if (print) {
+            printf("  ok\n");
+        }
+    }
+
+    // A path in the baseline that no longer runs would otherwise drop out of the comparison unnoticed
+    for (const auto &entry : baseline) {
+        if (entry.first == REFERENCE_PATH) continue;
+        if (print) printf("%-28s not measured, but listed in the baseline\n", entry.first.c_str());
+        regressions++;
+    }
+    return regressions;
+}
+
+int main(int argc, char **argv) {
+    bool update = argc == 3 && strcmp(argv[1], "--update") == 0;
+    if (argc < 2 || (!update && argc > 3)) {
+        printf("usage: %s <baseline file> [threshold percent]\n       %s --update <baseline file>\n", argv[0], argv[0]);
+        return 2;
+    }
+    const char *baselinePath = update ? argv[2] : argv[1];
+    double threshold = !update && argc == 3 ? atof(argv[2]) : 50;
+
+    Preferences::clear();
+    EventLoop::begin();
+    ledController.begin();
+    webController.begin();
+
+    addReferencePath();
+    addRenderPaths();
+    addEventPaths();
+    addWebPaths();
+    runPaths();
+
+    if (update) {
+        // Record the best the comparison could reach, so a baseline written in a slow spell
+        // does not hide later regressions
+        for (int retry = 0; retry < RETRIES; retry++) runPaths();
+        if (!writeBaseline(baselinePath)) {
+            printf("Could not write %s\n", baselinePath);
+            return 1;
+        }
+        printf("Baseline written to %s\n", baselinePath);
+        return failures == 0 ? 0 : 1;
+    }
+
+    std::map<std::string, Result> baseline = readBaseline(baselinePath);
+
+    // A slow spell on a shared machine can slow some paths more than the reference. Before reporting
+    // a path as slower, give it more rounds to show its usual speed: a real regression stays slow.
+    for (int retry = 0; retry < RETRIES && compareWithBaseline(baseline, threshold, false) > 0; retry++) {
+        runPaths();
+    }
+    int regressions = compareWithBaseline(baseline, threshold, true);
+
+    if (regressions > 0) {
+        printf("%d path(s) regressed by more than %.0f%% or do not match %s\n", regressions, threshold, baselinePath);
+    }
+    return failures == 0 && regressions == 0 ? 0 : 1;
+}
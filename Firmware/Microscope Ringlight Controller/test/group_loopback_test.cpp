@@ -0,0 +1,280 @@
+// Runs a leader and several members on one simulated multicast network, each with its own clock,
+// and checks that the group follows the leader:
+//   - frames are delayed by a random time, so some arrive out of order, and some are dropped,
+//     never two in a row to the same member, as a heartbeat then always gets through
+//   - after each change on the leader every member shows the same state, render source included,
+//     within GROUP_HEARTBEAT plus the longest network delay
+// Then a client sends frames with applyAt in the future, and the spread of the times the members
+// show each one is reported and checked against the network's delay jitter.
+//
+// The nodes share LEDController's event queue, so each node's group and LED controllers are run
+// together before the next node's.
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <random>
+#include <vector>
+#include "LEDController.h"
+#include "GroupController.h"
+
+const int MEMBERS = 4;
+const uint8_t GROUP = 3;
+const uint32_t MIN_NETWORK_DELAY = 1; // ms
+const uint32_t MAX_NETWORK_DELAY = 40; // ms
+const uint32_t DROP_ONE_IN = 4;
+const uint32_t CONVERGENCE_LIMIT = GROUP_HEARTBEAT + MAX_NETWORK_DELAY + 1;
+const int CLIENT_FRAMES = 20;
+const uint32_t CLIENT_FRAME_INTERVAL = 500; // ms, longer than the lead so each frame is shown before the next
+const uint32_t CLIENT_APPLY_LEAD = 300; // ms from sending a client frame until it should be shown
+
+struct Node {
+    LEDController led;
+    GroupController group{led};
+    uint32_t clockOffset = 0; // this node's millis() minus the simulation's, 0 for the leader
+    uint32_t lastSequence = 0; // highest sequence number delivered to it
+    bool lastDropped = false; // the last frame sent to it was dropped
+};
+
+// A frame on its way to one listener
+struct Flight {
+    uint32_t arrival;
+    AsyncUDP *listener;
+    std::vector<uint8_t> data;
+};
+
+static std::mt19937 chance(7); // fixed seed, so every run sees the same delays and losses
+static std::vector<std::unique_ptr<Node>> nodes; // the leader, then the members
+static std::map<AsyncUDP*, Node*> owners;
+static std::vector<Flight> inFlight;
+static uint32_t dropped = 0;
+static uint32_t reordered = 0;
+static int failures = 0;
+
+static void check(bool condition, const char *message) {
+    if (!condition) {
+        printf("FAIL: %s\n", message);
+        failures++;
+    }
+}
+
+// Run code as the given node, on its clock
+template <typename Code>
+static void runOn(Node &node, Code code) {
+    SimulatedClockOffset = node.clockOffset;
+    code();
+    SimulatedClockOffset = 0;
+}
+
+static void send(AsyncUDP &sender, const uint8_t *data, size_t length) {
+    for (AsyncUDP *listener : AsyncUDP::listeners) {
+        if (listener == &sender) continue;
+        Node *receiver = owners[listener];
+        receiver->lastDropped = !receiver->lastDropped && chance() % DROP_ONE_IN == 0;
+        if (receiver->lastDropped) {
+            dropped++;
+            continue;
+        }
+        uint32_t delay = MIN_NETWORK_DELAY + chance() % (MAX_NETWORK_DELAY - MIN_NETWORK_DELAY + 1);
+        inFlight.push_back({SimulatedMillis + delay, listener, std::vector<uint8_t>(data, data + length)});
+    }
+}
+
+// Advance the simulation by 1ms: deliver the frames that have arrived, then run every node once
+static void step() {
+    SimulatedMillis++;
+
+    std::vector<Flight> arrived;
+    for (auto flight = inFlight.begin(); flight != inFlight.end();) {
+        if (int32_t(SimulatedMillis - flight->arrival) >= 0) {
+            arrived.push_back(std::move(*flight));
+            flight = inFlight.erase(flight);
+        }
+        else {
+            ++flight;
+        }
+    }
+    for (Flight &flight : arrived) {
+        Node &node = *owners[flight.listener];
+        GroupFrame frame;
+        memcpy(&frame, flight.data.data(), sizeof(frame));
+        if (int32_t(frame.sequence - node.lastSequence) < 0) reordered++;
+        else node.lastSequence = frame.sequence;
+
+        runOn(node, [&]() { flight.listener->receive(flight.data.data(), flight.data.size()); });
+    }
+
+    for (auto &node : nodes) {
+        runOn(*node, [&]() {
+            node->group.Process();
+            node->led.Process();
+        });
+    }
+}
+
+static bool power(const LEDController &led) {
+    return led.currentMode != LEDController::ModeOff;
+}
+
+static bool showsSameAs(const LEDController &member, const LEDController &leader) {
+    if (power(member) != power(leader)) return false;
+    if (power(leader) && member.currentBrightness != leader.currentBrightness) return false;
+    return member.currentTemperature == leader.currentTemperature && member.currentDirection == leader.currentDirection &&
+           member.renderSource == leader.renderSource;
+}
+
+static bool converged() {
+    for (size_t i = 1; i < nodes.size(); i++) {
+        if (!showsSameAs(nodes[i]->led, nodes[0]->led)) return false;
+    }
+    return true;
+}
+
+// Make a change on the leader, then run until every member shows it
+static uint32_t slowestConvergence = 0;
+template <typename Change>
+static void changeLeader(const char *name, Change change) {
+    Node &leader = *nodes[0];
+    runOn(leader, [&]() {
+        change();
+        leader.led.Process();
+    });
+
+    uint32_t start = SimulatedMillis;
+    while (!converged() && SimulatedMillis - start <= CONVERGENCE_LIMIT) step();
+    uint32_t took = SimulatedMillis - start;
+    slowestConvergence = std::max(slowestConvergence, took);
+
+    if (!converged()) {
+        printf("FAIL: the members did not show \"%s\" within %ums\n", name, CONVERGENCE_LIMIT);
+        failures++;
+    }
+}
+
+// A client drives the members directly with frames that should be shown CLIENT_APPLY_LEAD later,
+// and the spread of the times they show each one is measured
+static void clientFrames() {
+    AsyncUDP client;
+    uint32_t clientOffset = 987654321;
+    uint32_t session = chance();
+    uint32_t worstSkew = 0;
+    uint32_t worstLateness = 0;
+    uint64_t totalSkew = 0;
+    int measuredFrames = 0;
+
+    runOn(*nodes[0], [&]() { nodes[0]->group.setRole(GroupController::RoleOff, GROUP); });
+
+    for (int n = 1; n <= CLIENT_FRAMES; n++) {
+        GroupFrame frame = {};
+        frame.magic = GROUP_FRAME_MAGIC;
+        frame.version = GROUP_FRAME_VERSION;
+        frame.group = GROUP;
+        frame.session = session;
+        frame.sequence = n;
+        frame.senderTime = SimulatedMillis + clientOffset;
+        frame.applyAt = frame.senderTime + CLIENT_APPLY_LEAD;
+        frame.power = 1;
+        frame.brightness = 20 + 10 * n; // a new value each time, so a member that missed a frame cannot seem to show the next
+        frame.temperature = 4500;
+        frame.direction = 0;
+        frame.source = LEDController::RenderTemperature;
+        client.writeTo(reinterpret_cast<const uint8_t*>(&frame), sizeof(frame), GROUP_ADDRESS, GROUP_PORT);
+
+        // Note when each member shows the frame, in the simulation's time
+        uint32_t intended = frame.applyAt - clientOffset;
+        std::vector<uint32_t> shownAt(nodes.size(), 0);
+        for (uint32_t t = 0; t < CLIENT_FRAME_INTERVAL; t++) {
+            step();
+            for (size_t i = 1; i < nodes.size(); i++) {
+                if (shownAt[i] == 0 && nodes[i]->led.currentBrightness == frame.brightness) shownAt[i] = SimulatedMillis;
+            }
+        }
+
+        uint32_t first = UINT32_MAX;
+        uint32_t last = 0;
+        for (size_t i = 1; i < nodes.size(); i++) {
+            if (shownAt[i] == 0) continue; // the frame was dropped on the way to this member
+            first = std::min(first, shownAt[i]);
+            last = std::max(last, shownAt[i]);
+            worstLateness = std::max(worstLateness, shownAt[i] - intended);
+            check(int32_t(shownAt[i] - intended) >= 0, "a member showed a client frame before its applyAt");
+        }
+        if (last == 0) continue;
+        uint32_t skew = last - first;
+        totalSkew += skew;
+        measuredFrames++;
+        worstSkew = std::max(worstSkew, skew);
+    }
+
+    printf("client frames with applyAt %ums ahead: skew between members %.1fms on average, %ums at most, "
+           "shown at most %ums after applyAt\n",
+           CLIENT_APPLY_LEAD, double(totalSkew) / std::max(measuredFrames, 1), worstSkew, worstLateness);
+
+    // A member's estimate of the client's clock is off by the delay of the fastest frame it has seen,
+    // so members can disagree by no more than the network's delay jitter
+    check(worstSkew <= MAX_NETWORK_DELAY - MIN_NETWORK_DELAY, "members showed a client frame further apart than the network jitter");
+}
+
+int main() {
+    Preferences::clear();
+    EventLoop::begin();
+    AsyncUDP::network = send;
+
+    // Every node restores the same saved state, then the members are moved away from it
+    for (int i = 0; i <= MEMBERS; i++) {
+        nodes.push_back(std::make_unique<Node>());
+        Node &node = *nodes.back();
+        node.clockOffset = i == 0 ? 0 : chance();
+        runOn(node, [&]() {
+            node.led.begin();
+            node.led.Process();
+            node.group.begin();
+            node.group.setRole(i == 0 ? GroupController::RoleLeader : GroupController::RoleMember, GROUP);
+            if (i > 0) {
+                LEDController::setBrightness(30 * i);
+                LEDController::setDirection(i);
+                node.led.Process();
+            }
+        });
+    }
+    for (size_t i = 0; i < AsyncUDP::listeners.size(); i++) owners[AsyncUDP::listeners[i]] = nodes[i].get();
+
+    changeLeader("the leader's state", []() {});
+    changeLeader("brightness", []() { LEDController::setBrightness(120); });
+    changeLeader("temperature", []() { LEDController::setTemperature(3000); });
+    changeLeader("direction", []() { LEDController::setDirection(5); });
+    changeLeader("temperature then direction", []() {
+        LEDController::setTemperature(6500);
+        LEDController::setDirection(7);
+    });
+    changeLeader("direction then temperature", []() {
+        LEDController::setDirection(9);
+        LEDController::setTemperature(4000);
+    });
+    changeLeader("the same direction again", []() { LEDController::setDirection(9); });
+    changeLeader("the same temperature again", []() { LEDController::setTemperature(4000); });
+    changeLeader("off", []() { LEDController::Off(); });
+    changeLeader("on", []() { LEDController::On(); });
+
+    // A slider drag sends frames faster than the network delivers them, so they overtake each other
+    changeLeader("a slider drag", []() {
+        for (uint8_t brightness = 20; brightness < 250; brightness += 10) {
+            LEDController::setBrightness(brightness);
+            nodes[0]->led.Process();
+            for (int t = 0; t < 5; t++) step();
+        }
+    });
+    check(reordered > 0, "no frames arrived out of order, the test does not cover reordering");
+    check(dropped > 0, "no frames were dropped, the test does not cover lost frames");
+
+    printf("%d members followed every change within %ums, limit %ums, %u frames dropped, %u out of order\n",
+           MEMBERS, slowestConvergence, CONVERGENCE_LIMIT, dropped, reordered);
+
+    clientFrames();
+
+    AsyncUDP::network = nullptr;
+    if (failures > 0) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,62 @@
+#include "heap_counter.h"
+#include <cerrno>
+#include <cstddef>
+#include <malloc.h>
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *pointer, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *pointer);
+}
+
+bool countAllocations = false;
+uint64_t allocations = 0;
+uint64_t allocatedBytes = 0;
+int64_t liveBytes = 0;
+
+// Live bytes are counted by the size glibc gives each block, which is also what free() returns
+static void *allocated(void *pointer, size_t size) {
+    if (pointer == nullptr) return nullptr;
+    if (countAllocations) {
+        allocations++;
+        allocatedBytes += size;
+    }
+    liveBytes += int64_t(malloc_usable_size(pointer));
+    return pointer;
+}
+
+extern "C" void *malloc(size_t size) {
+    return allocated(__libc_malloc(size), size);
+}
+
+extern "C" void *calloc(size_t count, size_t size) {
+    return allocated(__libc_calloc(count, size), count * size);
+}
+
+extern "C" void *realloc(void *pointer, size_t size) {
+    size_t oldSize = malloc_usable_size(pointer); // 0 for nullptr
+    void *moved = __libc_realloc(pointer, size);
+    if (moved == nullptr && size > 0) return nullptr; // the old block is untouched
+    liveBytes -= int64_t(oldSize);
+    return allocated(moved, size);
+}
+
+extern "C" void *memalign(size_t alignment, size_t size) {
+    return allocated(__libc_memalign(alignment, size), size);
+}
+
+extern "C" void *aligned_alloc(size_t alignment, size_t size) {
+    return memalign(alignment, size);
+}
+
+extern "C" int posix_memalign(void **pointer, size_t alignment, size_t size) {
+    *pointer = memalign(alignment, size);
+    return *pointer == nullptr ? ENOMEM : 0;
+}
+
+extern "C" void free(void *pointer) {
+    liveBytes -= int64_t(malloc_usable_size(pointer));
+    __libc_free(pointer);
+}
@@ -0,0 +1,13 @@
+// Heap use of the host tests, counted by wrapping glibc's allocator, which operator new also goes through.
+// Build heap_counter.cpp into the test to use it.
+#ifndef MICROSCOPE_RINGLIGHT_CONTROLLER_TEST_HEAP_COUNTER_H
+#define MICROSCOPE_RINGLIGHT_CONTROLLER_TEST_HEAP_COUNTER_H
+
+#include <cstdint>
+
+extern bool countAllocations;    // allocations and allocatedBytes only grow while this is set
+extern uint64_t allocations;     // calls to malloc, calloc and realloc
+extern uint64_t allocatedBytes;  // bytes asked for by those calls
+extern int64_t liveBytes;        // usable bytes allocated and not yet freed, always kept
+
+#endif //MICROSCOPE_RINGLIGHT_CONTROLLER_TEST_HEAP_COUNTER_H
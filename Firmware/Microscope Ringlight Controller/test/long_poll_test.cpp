@@ -0,0 +1,151 @@
+// Runs open UI pages against /getstate the way scripts.js does, with the web server polling held
+// requests every POLL_INTERVAL as AsyncTCP does, and counts the responses and bytes they cost:
+//   - idle, nothing changes: held requests time out and are answered with an empty body, so the
+//     pages cost one small response each per LONG_POLL_TIMEOUT and no state is sent at all
+//   - active, the state changes every few seconds: each page gets each change once, no later than
+//     one POLL_INTERVAL after it happened
+// Time is simulated in 1ms steps.
+#include <cstdio>
+#include <string>
+#include "LEDController.h"
+#include "EventLoop.h"
+#include "WebController.h"
+
+const int PAGES = 3;
+const uint32_t POLL_INTERVAL = 500; // ms between AsyncTCP polls of a connection
+const uint32_t DURATION = 10 * 60 * 1000; // ms, each run
+const uint32_t CHANGE_INTERVAL = 2300; // ms between changes in the active run, not a multiple of POLL_INTERVAL
+
+static LEDController ledController;
+static GroupController groupController(ledController);
+static WebController webController(ledController, groupController);
+extern AsyncWebServer webserver;
+
+// An open page and its long-poll request
+struct Page {
+    AsyncWebServerRequest request;
+    std::string generation;
+};
+static Page pages[PAGES];
+
+struct Totals {
+    uint32_t responses = 0;
+    uint32_t states = 0; // responses carrying the state
+    uint64_t bytes = 0;
+    uint32_t changes = 0;
+    uint32_t slowestUpdate = 0; // ms from a change until the last page had it
+};
+
+static int failures = 0;
+
+static void check(bool condition, const char *message) {
+    if (!condition) {
+        printf("FAIL: %s\n", message);
+        failures++;
+    }
+}
+
+// Send the page's next request, as pollStatus() does
+static void startPoll(Page &page) {
+    page.request.reset(HTTP_GET, "/getstate");
+    page.request.keepContent = true;
+    if (!page.generation.empty()) {
+        std::string etag = "\"" + page.generation + "\"";
+        page.request.addParam("since", page.generation.c_str());
+        page.request.addHeader("If-None-Match", etag.c_str());
+    }
+    webserver.handle(&page.request);
+}
+
+// Count a finished response and take the generation from it. Returns true if it carried the state.
+static bool finishPoll(Page &page, Totals &totals) {
+    AsyncWebServerRequest &request = page.request;
+    totals.responses++;
+    totals.bytes += request.sentLength;
+    if (request.response.code == 304 || (request.response.code == 200 && request.sentLength == 0)) return false;
+
+    check(request.response.code == 200, "/getstate failed");
+    JsonDocument doc;
+    check(!deserializeJson(doc, request.sentContent.c_str()), "/getstate did not send JSON");
+    page.generation = doc["generation"].as<String>().c_str();
+    totals.states++;
+    return true;
+}
+
+// Run the pages for DURATION, changing the state every changeInterval ms if it is not 0
+static Totals run(uint32_t changeInterval) {
+    Totals totals;
+    uint32_t lastChange = 0;
+    uint32_t pagesBehind = 0; // pages that have not yet had the last change
+    uint8_t brightness = 100;
+
+    for (Page &page : pages) startPoll(page);
+    for (uint32_t t = 1; t <= DURATION; t++) {
+        SimulatedMillis++;
+
+        if (changeInterval != 0 && t % changeInterval == 0) {
+            check(pagesBehind == 0, "a page had not had the last change when the next was made");
+            brightness = brightness == 100 ? 200 : 100;
+            LEDController::setBrightness(brightness);
+            ledController.Process();
+            totals.changes++;
+            lastChange = SimulatedMillis;
+            pagesBehind = PAGES;
+        }
+
+        if (t % POLL_INTERVAL != 0) continue;
+        for (Page &page : pages) {
+            if (page.request.held) page.request.poll();
+            // A page asks again as soon as it has an answer, which may be answered straight away
+            while (!page.request.held) {
+                if (finishPoll(page, totals) && pagesBehind > 0) {
+                    totals.slowestUpdate = std::max(totals.slowestUpdate, SimulatedMillis - lastChange);
+                    pagesBehind--;
+                }
+                startPoll(page);
+            }
+        }
+    }
+    for (Page &page : pages) page.request.reset(HTTP_GET, "/getstate"); // close the connections
+    return totals;
+}
+
+static void report(const char *name, const Totals &totals) {
+    double minutes = DURATION / 60000.0;
+    printf("%-7s %d pages: %6.1f responses/min, %5.1f with the state, %8.1f bytes/min",
+           name, PAGES, totals.responses / minutes, totals.states / minutes, totals.bytes / minutes);
+    if (totals.changes > 0) printf(", changes shown within %ums", totals.slowestUpdate);
+    printf("\n");
+}
+
+int main() {
+    Preferences::clear();
+    EventLoop::begin();
+    ledController.begin();
+    ledController.Process();
+    webController.begin();
+
+    // The pages load the state once before the runs are counted
+    Totals load;
+    for (Page &page : pages) {
+        startPoll(page);
+        check(!page.request.held && finishPoll(page, load), "the first /getstate did not send the state");
+    }
+
+    Totals idle = run(0);
+    report("idle", idle);
+    check(idle.states == 0 && idle.bytes == 0, "idle pages were sent the state");
+    check(idle.responses <= PAGES * (DURATION / WebController::LONG_POLL_TIMEOUT + 1),
+          "idle pages were answered more than once per LONG_POLL_TIMEOUT");
+
+    Totals active = run(CHANGE_INTERVAL);
+    report("active", active);
+    check(active.states == PAGES * active.changes, "the pages were not sent each change exactly once");
+    check(active.slowestUpdate <= POLL_INTERVAL, "a change reached a page more than one poll interval late");
+
+    if (failures > 0) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
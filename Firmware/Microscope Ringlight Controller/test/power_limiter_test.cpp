@@ -0,0 +1,95 @@
+// Checks the power model's running load and the brightness limiter, and measures their cost
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include "RenderKernel.h"
+
+const uint8_t PIXELS = 46; // LED_COUNT
+const uint32_t FRAMES = 100000;
+
+static int failures = 0;
+
+static void check(bool condition, const char *message) {
+    if (!condition) {
+        printf("FAIL: %s\n", message);
+        failures++;
+    }
+}
+
+static uint32_t channelSum(const CRGB *leds) {
+    uint32_t sum = 0;
+    for (uint8_t i = 0; i < PIXELS; i++) sum += leds[i].r + leds[i].g + leds[i].b;
+    return sum;
+}
+
+// Current drawn by a frame in the power model, worked out without any integer rounding
+static double modelCurrent(uint32_t load, uint8_t brightness) {
+    return PIXELS * LED_IDLE_MA + double(load) * LED_CHANNEL_MA * brightness / (255.0 * 255.0);
+}
+
+int main() {
+    std::mt19937 random(2);
+    CRGB frame[PIXELS];
+    CRGB leds[PIXELS];
+    uint8_t gains[PIXELS][3];
+    uint8_t gamma[256];
+    for (uint16_t i = 0; i < 256; i++) gamma[i] = uint8_t(i);
+    for (auto & gain : gains) gain[0] = gain[1] = gain[2] = 255;
+
+    uint32_t frameLoad = 0;
+    uint32_t limitedFrames = 0;
+    double worstError = 0;
+
+    for (uint32_t n = 0; n < FRAMES; n++) {
+        // Change a random number of pixels, from one to all of them, as the events do.
+        // Every other frame uses bright pixels so the limiter is exercised often.
+        uint8_t changes = 1 + random() % PIXELS;
+        uint8_t floor = n % 2 ? 192 : 0;
+        for (uint8_t c = 0; c < changes; c++) {
+            frame[random() % PIXELS] = CRGB(floor | (random() & 0xFF), floor | (random() & 0xFF), floor | (random() & 0xFF));
+        }
+        frameLoad += applyCalibration(frame, leds, gains, gamma, PIXELS);
+        if (frameLoad != channelSum(leds)) {
+            check(false, "running load does not match a full rescan");
+            break;
+        }
+
+        uint8_t brightness = random() & 0xFF;
+        uint16_t estimate;
+        uint8_t limited = limitBrightness(frameLoad, brightness, PIXELS, estimate);
+
+        check(limited <= brightness, "limiter raised the brightness");
+        check(estimate <= POWER_BUDGET_MA, "estimated current is over the budget");
+        check(modelCurrent(frameLoad, limited) <= POWER_BUDGET_MA, "modelled current is over the budget");
+        if (limited < brightness) {
+            // The limit must be the highest brightness that fits
+            limitedFrames++;
+            check(modelCurrent(frameLoad, limited + 1) > POWER_BUDGET_MA, "limiter reduced the brightness more than needed");
+        }
+
+        double error = modelCurrent(frameLoad, limited) - estimate;
+        worstError = std::max(worstError, error);
+        check(error >= 0 && error < 1, "estimate is more than 1mA from the model");
+        if (failures > 10) break;
+    }
+
+    // A full white frame at full brightness must be limited
+    for (auto & pixel : frame) pixel = CRGB(255, 255, 255);
+    frameLoad += applyCalibration(frame, leds, gains, gamma, PIXELS);
+    uint16_t estimate;
+    check(limitBrightness(frameLoad, 255, PIXELS, estimate) < 255, "full white at full brightness was not limited");
+
+    // Cost of the limiter per frame
+    uint32_t checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t n = 0; n < FRAMES * 10; n++) {
+        checksum += limitBrightness(n % (PIXELS * 765), uint8_t(n), PIXELS, estimate) + estimate;
+    }
+    auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    printf("%u of %u random frames limited, worst estimate error %.3f mA\n", limitedFrames, FRAMES, worstError);
+    printf("limitBrightness: %.2f ns/frame (checksum %u)\n", elapsed / (FRAMES * 10), checksum);
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,74 @@
+// Checks the calibration kernel and measures its throughput
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include "RenderKernel.h"
+
+const uint8_t PIXELS = 46; // LED_COUNT
+const uint32_t ITERATIONS = 200000;
+
+static int failures = 0;
+
+static void check(bool condition, const char *message) {
+    if (!condition) {
+        printf("FAIL: %s\n", message);
+        failures++;
+    }
+}
+
+static uint32_t channelSum(const CRGB *leds) {
+    uint32_t sum = 0;
+    for (uint8_t i = 0; i < PIXELS; i++) sum += leds[i].r + leds[i].g + leds[i].b;
+    return sum;
+}
+
+int main() {
+    std::mt19937 random(1);
+    CRGB frame[PIXELS];
+    CRGB leds[PIXELS];
+    uint8_t gains[PIXELS][3];
+    uint8_t linear[256];
+    uint8_t gamma[256];
+
+    for (uint16_t i = 0; i < 256; i++) {
+        linear[i] = uint8_t(i);
+        gamma[i] = uint8_t((i * i) / 255); // roughly gamma 2.0
+    }
+
+    // Unity gains with a linear table must leave every pixel unchanged
+    for (uint8_t i = 0; i < PIXELS; i++) {
+        frame[i] = CRGB(random() & 0xFF, random() & 0xFF, random() & 0xFF);
+        gains[i][0] = gains[i][1] = gains[i][2] = 255;
+    }
+    int32_t load = applyCalibration(frame, leds, gains, linear, PIXELS);
+    for (uint8_t i = 0; i < PIXELS; i++) {
+        check(leds[i].r == frame[i].r && leds[i].g == frame[i].g && leds[i].b == frame[i].b, "unity calibration changed a pixel");
+    }
+    check(uint32_t(load) == channelSum(leds), "load change from an empty buffer does not match the channel sum");
+
+    // The running load must match a full rescan after many random frames and gains
+    for (uint32_t n = 0; n < 1000; n++) {
+        for (uint8_t i = 0; i < PIXELS; i++) {
+            frame[i] = CRGB(random() & 0xFF, random() & 0xFF, random() & 0xFF);
+            gains[i][0] = random() & 0xFF;
+            gains[i][1] = random() & 0xFF;
+            gains[i][2] = random() & 0xFF;
+        }
+        load += applyCalibration(frame, leds, gains, gamma, PIXELS);
+    }
+    check(uint32_t(load) == channelSum(leds), "running load drifted from the channel sum");
+
+    // Throughput
+    uint32_t checksum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t n = 0; n < ITERATIONS; n++) {
+        frame[n % PIXELS].r = uint8_t(n);
+        checksum += applyCalibration(frame, leds, gains, gamma, PIXELS);
+    }
+    auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    printf("applyCalibration: %.1f ns/frame, %.2f ns/pixel (checksum %u)\n",
+           elapsed / ITERATIONS, elapsed / ITERATIONS / PIXELS, checksum);
+
+    return failures == 0 ? 0 : 1;
+}
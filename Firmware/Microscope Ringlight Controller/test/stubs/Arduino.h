@@ -0,0 +1,76 @@
+// Host stand-in for the parts of the Arduino core used by the firmware.
+// Time is simulated: it only moves when delay() is called or the test advances SimulatedMillis.
+// A test simulating several devices gives each its own clock by setting SimulatedClockOffset while it runs.
+#ifndef MICROSCOPE_RINGLIGHT_CONTROLLER_TEST_ARDUINO_H
+#define MICROSCOPE_RINGLIGHT_CONTROLLER_TEST_ARDUINO_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <string>
+
+#define IRAM_ATTR
+#define HEX 16
+
+inline uint32_t SimulatedMillis = 0;
+inline uint32_t SimulatedClockOffset = 0;
+
+inline uint32_t millis() { return SimulatedMillis + SimulatedClockOffset; }
+inline uint32_t micros() { return millis() * 1000; }
+inline void delay(uint32_t ms) { SimulatedMillis += ms; }
+
+// FreeRTOS task notifications, the benchmark runs everything on one thread
+typedef void *TaskHandle_t;
+typedef int BaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define portMAX_DELAY UINT32_MAX
+#define pdMS_TO_TICKS(ms) (ms)
+#define portYIELD_FROM_ISR()
+
+inline TaskHandle_t xTaskGetCurrentTaskHandle() { static int task; return &task; }
+inline void xTaskNotifyGive(TaskHandle_t) {}
+inline void vTaskNotifyGiveFromISR(TaskHandle_t, BaseType_t *) {}
+inline uint32_t ulTaskNotifyTake(BaseType_t, TickType_t) { return 1; }
+
+// Arduino String, backed by std::string
+class String {
+public:
+    String() = default;
+    String(const char *text) : value(text ? text : "") {}
+    String(int number) : value(std::to_string(number)) {}
+    String(long number) : value(std::to_string(number)) {}
+    String(unsigned int number, unsigned char base = 10) : String((unsigned long)number, base) {}
+    String(unsigned long number, unsigned char base = 10) {
+        char text[24];
+        snprintf(text, sizeof(text), base == HEX ? "%lx" : "%lu", number);
+        value = text;
+    }
+
+    String &operator=(const char *text) { value = text ? text : ""; return *this; }
+    bool concat(const char *text) { value += text; return true; }
+    bool concat(char c) { value += c; return true; }
+    bool reserve(unsigned int size) { value.reserve(size); return true; }
+
+    // Lets ArduinoJson write to a String the same way it writes to a Print
+    size_t write(uint8_t c) { value += char(c); return 1; }
+    size_t write(const uint8_t *data, size_t length) { value.append(reinterpret_cast<const char*>(data), length); return length; }
+
+    const char *c_str() const { return value.c_str(); }
+    unsigned int length() const { return value.length(); }
+
+    String &operator+=(const String &other) { value += other.value; return *this; }
+    friend String operator+(const String &a, const String &b) { String result(a); result.value += b.value; return result; }
+    bool operator==(const String &other) const { return value == other.value; }
+    bool operator!=(const String &other) const { return value != other.value; }
+
+private:
+    std::string value;
+};
+
+#endif //MICROSCOPE_RINGLIGHT_CONTROLLER_TEST_ARDUINO_H
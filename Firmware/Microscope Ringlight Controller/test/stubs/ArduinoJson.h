@@ -0,0 +1,538 @@
+// Host stand-in for the parts of ArduinoJson 7 used by the firmware.
+// It parses and serializes real JSON with the same conversion rules, so the web handlers behave as on
+// the device, but its speed and heap use are its own rather than the library's.
+// Build with -DARDUINOJSON_INCLUDE_DIR=<ArduinoJson/src> to use the real library instead.
+#ifndef MICROSCOPE_RINGLIGHT_CONTROLLER_TEST_ARDUINOJSON_H
+#define MICROSCOPE_RINGLIGHT_CONTROLLER_TEST_ARDUINOJSON_H
+
+#include <Arduino.h>
+#include <cerrno>
+#include <limits>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace ArduinoJsonHost {
+
+const uint8_t NESTING_LIMIT = 10; // ARDUINOJSON_DEFAULT_NESTING_LIMIT
+
+struct Node {
+    enum Type { Null, Bool, Integer, Float, Text, Array, Object } type = Null;
+    bool boolean = false;
+    long long integer = 0;
+    double real = 0;
+    std::string text;
+    std::vector<std::string> keys; // object member names, in insertion order
+    std::vector<std::unique_ptr<Node>> children; // array elements or object members
+
+    void clear(Type newType) {
+        type = newType;
+        text.clear();
+        keys.clear();
+        children.clear();
+    }
+
+    Node *member(const char *key) const {
+        if (type != Object) return nullptr;
+        for (size_t i = 0; i < keys.size(); i++) {
+            if (keys[i] == key) return children[i].get();
+        }
+        return nullptr;
+    }
+
+    Node *addMember(const char *key) {
+        if (type != Object) clear(Object);
+        Node *existing = member(key);
+        if (existing != nullptr) return existing;
+        keys.emplace_back(key);
+        children.emplace_back(new Node());
+        return children.back().get();
+    }
+
+    Node *element(size_t index) const {
+        return type == Array && index < children.size() ? children[index].get() : nullptr;
+    }
+
+    Node *addElement() {
+        if (type != Array) clear(Array);
+        children.emplace_back(new Node());
+        return children.back().get();
+    }
+};
+
+template <typename T>
+inline bool integerFits(long long value) {
+    if (std::is_signed<T>::value) {
+        return value >= (long long)std::numeric_limits<T>::min() && value <= (long long)std::numeric_limits<T>::max();
+    }
+    return value >= 0 && (unsigned long long)value <= (unsigned long long)std::numeric_limits<T>::max();
+}
+
+template <typename T>
+inline void setNode(Node &node, const T &value) {
+    if constexpr (std::is_same<T, bool>::value) {
+        node.clear(Node::Bool);
+        node.boolean = value;
+    }
+    else if constexpr (std::is_integral<T>::value || std::is_enum<T>::value) {
+        node.clear(Node::Integer);
+        node.integer = (long long)value;
+    }
+    else if constexpr (std::is_floating_point<T>::value) {
+        node.clear(Node::Float);
+        node.real = value;
+    }
+    else if constexpr (std::is_convertible<T, const char*>::value) {
+        const char *text = value;
+        if (text == nullptr) {
+            node.clear(Node::Null);
+            return;
+        }
+        node.clear(Node::Text);
+        node.text = text;
+    }
+    else {
+        node.clear(Node::Text); // String and other classes with c_str()
+        node.text = value.c_str();
+    }
+}
+
+} // namespace ArduinoJsonHost
+
+class JsonArray;
+class JsonObject;
+
+// A value in a document. Reading a missing member gives null, assigning to one adds it.
+class JsonVariant {
+public:
+    JsonVariant() = default;
+    explicit JsonVariant(ArduinoJsonHost::Node *node) : node(node) {}
+    JsonVariant(ArduinoJsonHost::Node *parent, const char *key) : parent(parent), key(key) {
+        node = parent != nullptr ? parent->member(key) : nullptr;
+    }
+
+    bool isNull() const { return node == nullptr || node->type == ArduinoJsonHost::Node::Null; }
+
+    template <typename T>
+    bool is() const;
+
+    template <typename T>
+    T as() const;
+
+    template <typename T, typename = typename std::enable_if<!std::is_same<T, JsonVariant>::value>::type>
+    operator T() const { return as<T>(); }
+
+    template <typename T>
+    bool operator==(const T &value) const {
+        if constexpr (std::is_convertible<T, const char*>::value) {
+            return is<const char*>() && node->text == (const char*)value;
+        }
+        else {
+            return is<T>() && as<T>() == value;
+        }
+    }
+
+    template <typename T>
+    bool operator!=(const T &value) const { return !(*this == value); }
+
+    template <typename T, typename = typename std::enable_if<!std::is_same<T, JsonVariant>::value>::type>
+    JsonVariant &operator=(const T &value) {
+        ArduinoJsonHost::Node *target = resolve();
+        if (target != nullptr) ArduinoJsonHost::setNode(*target, value);
+        return *this;
+    }
+
+    JsonVariant operator[](const char *memberKey) const {
+        if (node != nullptr && node->type == ArduinoJsonHost::Node::Object) return JsonVariant(node, memberKey);
+        return JsonVariant();
+    }
+
+    JsonVariant operator[](int index) const {
+        return JsonVariant(node != nullptr && index >= 0 ? node->element(size_t(index)) : nullptr);
+    }
+
+    size_t size() const {
+        return node != nullptr && (node->type == ArduinoJsonHost::Node::Array || node->type == ArduinoJsonHost::Node::Object) ? node->children.size() : 0;
+    }
+
+    // Replace the value with an empty array or object and return it
+    template <typename T>
+    T to();
+
+private:
+    ArduinoJsonHost::Node *node = nullptr;
+    ArduinoJsonHost::Node *parent = nullptr; // object holding the member named key, for writes
+    const char *key = nullptr;
+
+    ArduinoJsonHost::Node *resolve() {
+        if (node == nullptr && parent != nullptr) node = parent->addMember(key);
+        return node;
+    }
+
+    friend class JsonArray;
+    friend class JsonObject;
+};
+
+class JsonArray {
+public:
+    JsonArray() = default;
+    explicit JsonArray(ArduinoJsonHost::Node *node) : node(node) {}
+
+    class iterator {
+    public:
+        iterator(const ArduinoJsonHost::Node *node, size_t index) : node(node), index(index) {}
+        JsonVariant operator*() const { return JsonVariant(node->children[index].get()); }
+        iterator &operator++() { index++; return *this; }
+        bool operator!=(const iterator &other) const { return index != other.index; }
+    private:
+        const ArduinoJsonHost::Node *node;
+        size_t index;
+    };
+
+    iterator begin() const { return iterator(node, 0); }
+    iterator end() const { return iterator(node, size()); }
+
+    bool isNull() const { return node == nullptr; }
+    size_t size() const { return node != nullptr ? node->children.size() : 0; }
+    JsonVariant operator[](int index) const { return JsonVariant(node != nullptr && index >= 0 ? node->element(size_t(index)) : nullptr); }
+
+    template <typename T>
+    T add() {
+        if (node == nullptr) return T();
+        JsonVariant element(node->addElement());
+        return element.to<T>();
+    }
+
+    template <typename T>
+    bool add(const T &value) {
+        if (node == nullptr) return false;
+        ArduinoJsonHost::setNode(*node->addElement(), value);
+        return true;
+    }
+
+private:
+    ArduinoJsonHost::Node *node = nullptr;
+};
+
+class JsonObject {
+public:
+    JsonObject() = default;
+    explicit JsonObject(ArduinoJsonHost::Node *node) : node(node) {}
+
+    bool isNull() const { return node == nullptr; }
+    size_t size() const { return node != nullptr ? node->children.size() : 0; }
+    JsonVariant operator[](const char *key) const { return node != nullptr ? JsonVariant(node, key) : JsonVariant(); }
+
+private:
+    ArduinoJsonHost::Node *node = nullptr;
+};
+
+template <typename T>
+bool JsonVariant::is() const {
+    using ArduinoJsonHost::Node;
+    if (node == nullptr) return false;
+    if constexpr (std::is_same<T, bool>::value) return node->type == Node::Bool;
+    else if constexpr (std::is_integral<T>::value) return node->type == Node::Integer && ArduinoJsonHost::integerFits<T>(node->integer);
+    else if constexpr (std::is_floating_point<T>::value) return node->type == Node::Integer || node->type == Node::Float;
+    else if constexpr (std::is_same<T, const char*>::value || std::is_same<T, String>::value) return node->type == Node::Text;
+    else if constexpr (std::is_same<T, JsonArray>::value) return node->type == Node::Array;
+    else if constexpr (std::is_same<T, JsonObject>::value) return node->type == Node::Object;
+    else return false;
+}
+
+template <typename T>
+T JsonVariant::as() const {
+    using ArduinoJsonHost::Node;
+    if constexpr (std::is_same<T, bool>::value) {
+        if (node == nullptr) return false;
+        if (node->type == Node::Bool) return node->boolean;
+        if (node->type == Node::Integer) return node->integer != 0;
+        if (node->type == Node::Float) return node->real != 0;
+        return node->type != Node::Null;
+    }
+    else if constexpr (std::is_integral<T>::value) {
+        // Out of range values read as 0, as in the library
+        if (node == nullptr) return 0;
+        if (node->type == Node::Integer) return ArduinoJsonHost::integerFits<T>(node->integer) ? T(node->integer) : T(0);
+        if (node->type == Node::Float) return ArduinoJsonHost::integerFits<T>((long long)node->real) ? T(node->real) : T(0);
+        if (node->type == Node::Bool) return T(node->boolean);
+        return 0;
+    }
+    else if constexpr (std::is_floating_point<T>::value) {
+        if (node == nullptr) return 0;
+        if (node->type == Node::Integer) return T(node->integer);
+        if (node->type == Node::Float) return T(node->real);
+        return 0;
+    }
+    else if constexpr (std::is_same<T, const char*>::value) {
+        return node != nullptr && node->type == Node::Text ? node->text.c_str() : nullptr;
+    }
+    else if constexpr (std::is_same<T, String>::value) {
+        return node != nullptr && node->type == Node::Text ? String(node->text.c_str()) : String();
+    }
+    else if constexpr (std::is_same<T, JsonArray>::value) {
+        return node != nullptr && node->type == Node::Array ? JsonArray(node) : JsonArray();
+    }
+    else if constexpr (std::is_same<T, JsonObject>::value) {
+        return node != nullptr && node->type == Node::Object ? JsonObject(node) : JsonObject();
+    }
+}
+
+template <typename T>
+T JsonVariant::to() {
+    using ArduinoJsonHost::Node;
+    Node *target = resolve();
+    if (target == nullptr) return T();
+    if constexpr (std::is_same<T, JsonArray>::value) {
+        target->clear(Node::Array);
+        return JsonArray(target);
+    }
+    else {
+        target->clear(Node::Object);
+        return JsonObject(target);
+    }
+}
+
+class JsonDocument {
+public:
+    JsonVariant operator[](const char *key) { return JsonVariant(&root, key); }
+    bool isNull() const { return root.type == ArduinoJsonHost::Node::Null; }
+    void clear() { root.clear(ArduinoJsonHost::Node::Null); }
+
+    ArduinoJsonHost::Node root;
+};
+
+class DeserializationError {
+public:
+    enum Code { Ok, EmptyInput, IncompleteInput, InvalidInput, NoMemory, TooDeep };
+
+    DeserializationError(Code code = Ok) : errorCode(code) {}
+    explicit operator bool() const { return errorCode != Ok; }
+    bool operator==(Code code) const { return errorCode == code; }
+    Code code() const { return errorCode; }
+
+    const char *c_str() const {
+        static const char *const names[] = {"Ok", "EmptyInput", "IncompleteInput", "InvalidInput", "NoMemory", "TooDeep"};
+        return names[errorCode];
+    }
+    const char *f_str() const { return c_str(); }
+
+private:
+    Code errorCode;
+};
+
+namespace ArduinoJsonHost {
+
+class Parser {
+public:
+    explicit Parser(const char *input) : input(input) {}
+
+    DeserializationError parse(Node &root) {
+        if (input == nullptr) return DeserializationError::EmptyInput;
+        skipSpace();
+        if (*input == 0) return DeserializationError::EmptyInput;
+        return value(root, 0);
+    }
+
+private:
+    const char *input;
+
+    void skipSpace() {
+        while (*input == ' ' || *input == '\t' || *input == '\n' || *input == '\r') input++;
+    }
+
+    static DeserializationError endOrInvalid(char c) {
+        return c == 0 ? DeserializationError::IncompleteInput : DeserializationError::InvalidInput;
+    }
+
+    DeserializationError value(Node &node, uint8_t depth) {
+        skipSpace();
+        char c = *input;
+        if (c == '{' || c == '[') {
+            if (depth >= NESTING_LIMIT) return DeserializationError::TooDeep;
+            return c == '{' ? object(node, depth + 1) : array(node, depth + 1);
+        }
+        if (c == '"') {
+            node.clear(Node::Text);
+            return string(node.text);
+        }
+        if (c == '-' || (c >= '0' && c <= '9')) return number(node);
+        if (literal("true")) { setNode(node, true); return DeserializationError::Ok; }
+        if (literal("false")) { setNode(node, false); return DeserializationError::Ok; }
+        if (literal("null")) { node.clear(Node::Null); return DeserializationError::Ok; }
+        return endOrInvalid(c);
+    }
+
+    bool literal(const char *word) {
+        size_t length = strlen(word);
+        if (strncmp(input, word, length) != 0) return false;
+        input += length;
+        return true;
+    }
+
+    DeserializationError object(Node &node, uint8_t depth) {
+        node.clear(Node::Object);
+        input++;
+        skipSpace();
+        if (*input == '}') { input++; return DeserializationError::Ok; }
+        while (true) {
+            skipSpace();
+            if (*input != '"') return endOrInvalid(*input);
+            std::string key;
+            DeserializationError error = string(key);
+            if (error) return error;
+            skipSpace();
+            if (*input != ':') return endOrInvalid(*input);
+            input++;
+            error = value(*node.addMember(key.c_str()), depth);
+            if (error) return error;
+            skipSpace();
+            if (*input == ',') { input++; continue; }
+            if (*input == '}') { input++; return DeserializationError::Ok; }
+            return endOrInvalid(*input);
+        }
+    }
+
+    DeserializationError array(Node &node, uint8_t depth) {
+        node.clear(Node::Array);
+        input++;
+        skipSpace();
+        if (*input == ']') { input++; return DeserializationError::Ok; }
+        while (true) {
+            DeserializationError error = value(*node.addElement(), depth);
+            if (error) return error;
+            skipSpace();
+            if (*input == ',') { input++; continue; }
+            if (*input == ']') { input++; return DeserializationError::Ok; }
+            return endOrInvalid(*input);
+        }
+    }
+
+    DeserializationError string(std::string &text) {
+        input++;
+        while (true) {
+            char c = *input++;
+            if (c == 0) return DeserializationError::IncompleteInput;
+            if (c == '"') return DeserializationError::Ok;
+            if (c != '\\') { text += c; continue; }
+
+            c = *input++;
+            switch (c) {
+                case '"': case '\\': case '/': text += c; break;
+                case 'b': text += '\b'; break;
+                case 'f': text += '\f'; break;
+                case 'n': text += '\n'; break;
+                case 'r': text += '\r'; break;
+                case 't': text += '\t'; break;
+                case 'u': {
+                    unsigned code;
+                    if (sscanf(input, "%4x", &code) != 1) return DeserializationError::InvalidInput;
+                    input += 4;
+                    if (code < 0x80) {
+                        text += char(code);
+                    } else if (code < 0x800) {
+                        text += char(0xC0 | (code >> 6));
+                        text += char(0x80 | (code & 0x3F));
+                    } else {
+                        text += char(0xE0 | (code >> 12));
+                        text += char(0x80 | ((code >> 6) & 0x3F));
+                        text += char(0x80 | (code & 0x3F));
+                    }
+                    break;
+                }
+                case 0: return DeserializationError::IncompleteInput;
+                default: return DeserializationError::InvalidInput;
+            }
+        }
+    }
+
+    DeserializationError number(Node &node) {
+        const char *start = input;
+        if (*input == '-') input++;
+        bool isFloat = false;
+        while ((*input >= '0' && *input <= '9') || *input == '.' || *input == 'e' || *input == 'E' ||
+               ((*input == '+' || *input == '-') && (input[-1] == 'e' || input[-1] == 'E'))) {
+            if (*input == '.' || *input == 'e' || *input == 'E') isFloat = true;
+            input++;
+        }
+        std::string text(start, input);
+        char *end;
+        if (!isFloat) {
+            errno = 0;
+            long long integer = strtoll(text.c_str(), &end, 10);
+            if (*end == 0 && errno == 0) {
+                setNode(node, integer);
+                return DeserializationError::Ok;
+            }
+        }
+        double real = strtod(text.c_str(), &end);
+        if (*end != 0) return DeserializationError::InvalidInput;
+        setNode(node, real);
+        return DeserializationError::Ok;
+    }
+};
+
+inline void serialize(const Node &node, std::string &output) {
+    char number[32];
+    switch (node.type) {
+        case Node::Null: output += "null"; break;
+        case Node::Bool: output += node.boolean ? "true" : "false"; break;
+        case Node::Integer: snprintf(number, sizeof(number), "%lld", node.integer); output += number; break;
+        case Node::Float: snprintf(number, sizeof(number), "%.9g", node.real); output += number; break;
+        case Node::Text:
+            output += '"';
+            for (char c : node.text) {
+                switch (c) {
+                    case '"': output += "\\\""; break;
+                    case '\\': output += "\\\\"; break;
+                    case '\b': output += "\\b"; break;
+                    case '\f': output += "\\f"; break;
+                    case '\n': output += "\\n"; break;
+                    case '\r': output += "\\r"; break;
+                    case '\t': output += "\\t"; break;
+                    default: output += c;
+                }
+            }
+            output += '"';
+            break;
+        case Node::Array:
+            output += '[';
+            for (size_t i = 0; i < node.children.size(); i++) {
+                if (i > 0) output += ',';
+                serialize(*node.children[i], output);
+            }
+            output += ']';
+            break;
+        case Node::Object:
+            output += '{';
+            for (size_t i = 0; i < node.children.size(); i++) {
+                if (i > 0) output += ',';
+                Node key;
+                setNode(key, node.keys[i].c_str());
+                serialize(key, output);
+                output += ':';
+                serialize(*node.children[i], output);
+            }
+            output += '}';
+            break;
+    }
+}
+
+} // namespace ArduinoJsonHost
+
+inline DeserializationError deserializeJson(JsonDocument &doc, const char *input) {
+    doc.clear();
+    DeserializationError error = ArduinoJsonHost::Parser(input).parse(doc.root);
+    if (error) doc.clear();
+    return error;
+}
+
+inline size_t serializeJson(const JsonDocument &doc, String &output) {
+    std::string text;
+    ArduinoJsonHost::serialize(doc.root, text);
+    output = text.c_str();
+    return text.size();
+}
+
+#endif //MICROSCOPE_RINGLIGHT_CONTROLLER_TEST_ARDUINOJSON_H
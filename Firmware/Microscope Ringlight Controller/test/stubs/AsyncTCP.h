@@ -0,0 +1,5 @@
+// Host stand-in for AsyncTCP, the simulated web server has no sockets
+#ifndef MICROSCOPE_RINGLIGHT_CONTROLLER_TEST_ASYNCTCP_H
+#define MICROSCOPE_RINGLIGHT_CONTROLLER_TEST_ASYNCTCP_H
+
+#endif //MICROSCOPE_RINGLIGHT_CONTROLLER_TEST_ASYNCTCP_H
@@ -0,0 +1,64 @@
+// Host stand-in for AsyncUDP. Frames are counted, and handed to AsyncUDP::network when a test has
+// set it, so the test can carry them to the other listeners with its own delays, losses and reordering.
+#ifndef MICROSCOPE_RINGLIGHT_CONTROLLER_TEST_ASYNCUDP_H
+#define MICROSCOPE_RINGLIGHT_CONTROLLER_TEST_ASYNCUDP_H
+
+#include <Arduino.h>
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+class IPAddress {
+public:
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : address{a, b, c, d} {}
+private:
+    uint8_t address[4];
+};
+
+class AsyncUDPPacket {
+public:
+    AsyncUDPPacket(uint8_t *data, size_t length) : packetData(data), packetLength(length) {}
+    uint8_t *data() { return packetData; }
+    size_t length() { return packetLength; }
+private:
+    uint8_t *packetData;
+    size_t packetLength;
+};
+
+typedef std::function<void(AsyncUDPPacket &packet)> AuPacketHandlerFunction;
+
+class AsyncUDP {
+public:
+    typedef std::function<void(AsyncUDP &sender, const uint8_t *data, size_t length)> Network;
+
+    inline static std::vector<AsyncUDP*> listeners; // every AsyncUDP listening for multicast
+    inline static Network network;                   // called with each frame written, when set
+
+    uint32_t sent = 0;
+
+    AsyncUDP() = default;
+    AsyncUDP(const AsyncUDP &) = delete;
+    ~AsyncUDP() { listeners.erase(std::remove(listeners.begin(), listeners.end(), this), listeners.end()); }
+
+    bool listenMulticast(const IPAddress &address, uint16_t port) {
+        listeners.push_back(this);
+        return true;
+    }
+    void onPacket(AuPacketHandlerFunction callback) { handler = callback; }
+    size_t writeTo(const uint8_t *data, size_t length, const IPAddress &address, uint16_t port) {
+        sent++;
+        if (network) network(*this, data, length);
+        return length;
+    }
+
+    // Deliver a packet as if it had arrived from the network
+    void receive(uint8_t *data, size_t length) {
+        AsyncUDPPacket packet(data, length);
+        if (handler) handler(packet);
+    }
+
+private:
+    AuPacketHandlerFunction handler;
+};
+
+#endif //MICROSCOPE_RINGLIGHT_CONTROLLER_TEST_ASYNCUDP_H
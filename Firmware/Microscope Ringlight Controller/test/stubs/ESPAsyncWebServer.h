@@ -0,0 +1,218 @@
+// Host stand-in for ESP Async WebServer.
+// Requests are built by the test and handed to AsyncWebServer::handle(), which runs the registered
+// body and request handlers the way the server does once a request has been read off the socket.
+// Responses are recorded on the request instead of being sent, with their body when the test asks for it.
+#ifndef MICROSCOPE_RINGLIGHT_CONTROLLER_TEST_ESPASYNCWEBSERVER_H
+#define MICROSCOPE_RINGLIGHT_CONTROLLER_TEST_ESPASYNCWEBSERVER_H
+
+#include <Arduino.h>
+#include <functional>
+#include <vector>
+#include "FS.h"
+
+#define RESPONSE_TRY_AGAIN 0xFFFFFFFF
+
+enum WebRequestMethod { HTTP_GET = 0b01, HTTP_POST = 0b10 };
+typedef uint8_t WebRequestMethodComposite;
+
+class AsyncWebServerRequest;
+
+typedef std::function<void(AsyncWebServerRequest *request)> ArRequestHandlerFunction;
+typedef std::function<void(AsyncWebServerRequest *request, const String &filename, size_t index, uint8_t *data, size_t len, bool final)> ArUploadHandlerFunction;
+typedef std::function<void(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total)> ArBodyHandlerFunction;
+typedef std::function<size_t(uint8_t *buffer, size_t maxLen, size_t index)> AwsResponseFiller;
+typedef std::function<void()> ArDisconnectHandler;
+
+// A request parameter or header
+class AsyncWebParameter {
+public:
+    const String &name() const { return paramName; }
+    const String &value() const { return paramValue; }
+    void set(const char *name, const char *value) { paramName = name; paramValue = value; }
+private:
+    String paramName;
+    String paramValue;
+};
+typedef AsyncWebParameter AsyncWebHeader;
+
+class AsyncWebServerResponse {
+public:
+    int code = 0;
+    size_t contentLength = 0;
+    AsyncWebHeader headers[4];
+    uint8_t headerCount = 0;
+    AwsResponseFiller filler;
+
+    void addHeader(const String &name, const String &value) {
+        if (headerCount < 4) headers[headerCount++].set(name.c_str(), value.c_str());
+    }
+
+    const String *header(const char *name) const {
+        for (uint8_t i = 0; i < headerCount; i++) {
+            if (headers[i].name() == name) return &headers[i].value();
+        }
+        return nullptr;
+    }
+};
+
+class AsyncWebServerRequest {
+public:
+    void *_tempObject = nullptr;
+
+    // Filled in by the test
+    WebRequestMethod method = HTTP_GET;
+    String url;
+    String body;
+
+    // Set when a handler sends a response
+    bool sent = false;
+    bool held = false; // a chunked response is waiting for RESPONSE_TRY_AGAIN to clear
+    size_t sentLength = 0;
+    AsyncWebServerResponse response;
+    bool keepContent = false; // set by the test to have the body kept in sentContent
+    String sentContent;
+
+    AsyncWebServerRequest() = default;
+    AsyncWebServerRequest(const AsyncWebServerRequest &) = delete;
+    ~AsyncWebServerRequest() { finish(); }
+
+    // Free what the handlers left behind, as the server does when the connection closes, and start over
+    void reset(WebRequestMethod newMethod, const char *newUrl, const char *newBody = "") {
+        finish();
+        method = newMethod;
+        url = newUrl;
+        body = newBody;
+        paramCount = 0;
+        headerCount = 0;
+        sent = false;
+        held = false;
+        sentLength = 0;
+        keepContent = false;
+        sentContent = "";
+        response.code = 0;
+        response.contentLength = 0;
+        response.headerCount = 0;
+        response.filler = nullptr;
+    }
+
+    void addParam(const char *name, const char *value) { if (paramCount < 2) params[paramCount++].set(name, value); }
+    void addHeader(const char *name, const char *value) { if (headerCount < 2) headers[headerCount++].set(name, value); }
+
+    bool hasParam(const String &name, bool post = false, bool file = false) const { return getParam(name) != nullptr; }
+    AsyncWebParameter *getParam(const String &name, bool post = false, bool file = false) const {
+        for (uint8_t i = 0; i < paramCount; i++) {
+            if (params[i].name() == name) return const_cast<AsyncWebParameter*>(&params[i]);
+        }
+        return nullptr;
+    }
+    bool hasHeader(const String &name) const { return getHeader(name) != nullptr; }
+    AsyncWebHeader *getHeader(const String &name) const {
+        for (uint8_t i = 0; i < headerCount; i++) {
+            if (headers[i].name() == name) return const_cast<AsyncWebHeader*>(&headers[i]);
+        }
+        return nullptr;
+    }
+
+    void onDisconnect(ArDisconnectHandler fn) { disconnectHandler = fn; }
+
+    AsyncWebServerResponse *beginResponse(int code, const String &contentType = String(), const String &content = String()) {
+        response.code = code;
+        response.contentLength = content.length();
+        if (keepContent) sentContent = content;
+        return &response;
+    }
+
+    AsyncWebServerResponse *beginChunkedResponse(const String &contentType, AwsResponseFiller callback) {
+        response.code = 200;
+        response.filler = callback;
+        return &response;
+    }
+
+    void send(AsyncWebServerResponse *) {
+        sent = true;
+        if (response.filler) {
+            poll();
+        }
+        else {
+            sentLength = response.contentLength;
+        }
+    }
+
+    void send(int code, const String &contentType = String(), const String &content = String()) {
+        send(beginResponse(code, contentType, content));
+    }
+
+    void send(FS &fs, const String &path, const String &contentType = String()) {
+        send(beginResponse(200, contentType));
+    }
+
+    // Ask a chunked response for more data, as the server does each time it polls the connection
+    void poll() {
+        uint8_t buffer[1460];
+        while (true) {
+            size_t length = response.filler(buffer, sizeof(buffer), sentLength);
+            held = length == RESPONSE_TRY_AGAIN;
+            if (held || length == 0) return;
+            if (keepContent) sentContent.write(buffer, length);
+            sentLength += length;
+        }
+    }
+
+private:
+    AsyncWebParameter params[2];
+    uint8_t paramCount = 0;
+    AsyncWebHeader headers[2];
+    uint8_t headerCount = 0;
+    ArDisconnectHandler disconnectHandler;
+
+    void finish() {
+        if (disconnectHandler) {
+            disconnectHandler();
+            disconnectHandler = nullptr;
+        }
+        free(_tempObject);
+        _tempObject = nullptr;
+    }
+};
+
+class AsyncWebServer {
+public:
+    explicit AsyncWebServer(uint16_t port) {}
+
+    void on(const char *uri, WebRequestMethodComposite method, ArRequestHandlerFunction onRequest,
+            ArUploadHandlerFunction onUpload = nullptr, ArBodyHandlerFunction onBody = nullptr) {
+        routes.push_back({uri, method, onRequest, onBody});
+    }
+    void onNotFound(ArRequestHandlerFunction fn) { notFoundHandler = fn; }
+    void begin() {}
+
+    // Run the handlers for a request, delivering its body in chunks of at most chunkSize bytes
+    void handle(AsyncWebServerRequest *request, size_t chunkSize = 1460) {
+        for (Route &route : routes) {
+            if (!(route.method & request->method) || !(request->url == route.uri)) continue;
+
+            if (route.onBody && request->body.length() > 0) {
+                auto *data = reinterpret_cast<uint8_t*>(const_cast<char*>(request->body.c_str()));
+                size_t total = request->body.length();
+                for (size_t index = 0; index < total; index += chunkSize) {
+                    route.onBody(request, data + index, std::min(chunkSize, total - index), index, total);
+                }
+            }
+            route.onRequest(request);
+            return;
+        }
+        if (notFoundHandler) notFoundHandler(request);
+    }
+
+private:
+    struct Route {
+        const char *uri;
+        WebRequestMethodComposite method;
+        ArRequestHandlerFunction onRequest;
+        ArBodyHandlerFunction onBody;
+    };
+    std::vector<Route> routes;
+    ArRequestHandlerFunction notFoundHandler;
+};
+
+#endif //MICROSCOPE_RINGLIGHT_CONTROLLER_TEST_ESPASYNCWEBSERVER_H
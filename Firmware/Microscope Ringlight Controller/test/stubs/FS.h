@@ -0,0 +1,10 @@
+// Host stand-in for the Arduino file system base class
+#ifndef MICROSCOPE_RINGLIGHT_CONTROLLER_TEST_FS_H
+#define MICROSCOPE_RINGLIGHT_CONTROLLER_TEST_FS_H
+
+namespace fs {
+class FS {};
+}
+using fs::FS;
+
+#endif //MICROSCOPE_RINGLIGHT_CONTROLLER_TEST_FS_H
@@ -0,0 +1,46 @@
+// Host stand-in for the parts of FastLED used by the firmware
+#ifndef MICROSCOPE_RINGLIGHT_CONTROLLER_TEST_FASTLED_H
+#define MICROSCOPE_RINGLIGHT_CONTROLLER_TEST_FASTLED_H
+
+#include <cstdint>
+
+struct CRGB {
+    uint8_t r = 0;
+    uint8_t g = 0;
+    uint8_t b = 0;
+
+    CRGB() = default;
+    CRGB(uint8_t r, uint8_t g, uint8_t b) : r(r), g(g), b(b) {}
+};
+
+// Same result as FastLED's scale8 with FASTLED_SCALE8_FIXED, the library default
+inline uint8_t scale8(uint8_t i, uint8_t scale) {
+    return uint8_t((uint16_t(i) * (1 + uint16_t(scale))) >> 8);
+}
+
+enum EOrder { RGB = 0012, GRB = 0102 };
+
+template <uint8_t DATA_PIN, EOrder RGB_ORDER> class WS2812B {};
+
+// Simulated LED ring, keeps what would have been sent so tests can inspect it
+class CFastLED {
+public:
+    static inline CRGB *leds = nullptr;
+    static inline int ledCount = 0;
+    uint8_t brightness = 255;
+    uint32_t shows = 0;
+
+    template <template <uint8_t DATA_PIN, EOrder RGB_ORDER> class CHIPSET, uint8_t DATA_PIN, EOrder RGB_ORDER>
+    static void addLeds(CRGB *data, int count) {
+        leds = data;
+        ledCount = count;
+    }
+
+    void setBrightness(uint8_t scale) { brightness = scale; }
+    void show() { shows++; }
+    void showColor(const CRGB &colour, uint8_t scale) { brightness = scale; shows++; }
+};
+
+inline CFastLED FastLED;
+
+#endif //MICROSCOPE_RINGLIGHT_CONTROLLER_TEST_FASTLED_H
@@ -0,0 +1,82 @@
+// Host stand-in for the NVS Preferences library.
+// Values live in a fixed table so simulated flash access does not show up as heap use,
+// and every put that changes a value counts as a flash write.
+#ifndef MICROSCOPE_RINGLIGHT_CONTROLLER_TEST_PREFERENCES_H
+#define MICROSCOPE_RINGLIGHT_CONTROLLER_TEST_PREFERENCES_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+class Preferences {
+public:
+    static inline uint32_t writes = 0;
+
+    bool begin(const char *name, bool readOnly = false) {
+        snprintf(space, sizeof(space), "%s", name);
+        this->readOnly = readOnly;
+        return true;
+    }
+    void end() {}
+
+    uint8_t getUChar(const char *key, uint8_t defaultValue = 0) { return get(key, defaultValue); }
+    uint16_t getUShort(const char *key, uint16_t defaultValue = 0) { return get(key, defaultValue); }
+    size_t putUChar(const char *key, uint8_t value) { return putBytes(key, &value, sizeof(value)); }
+    size_t putUShort(const char *key, uint16_t value) { return putBytes(key, &value, sizeof(value)); }
+
+    size_t getBytes(const char *key, void *buffer, size_t maxLength) {
+        Entry *entry = find(key, false);
+        if (entry == nullptr || entry->length > maxLength) return 0;
+        memcpy(buffer, entry->value, entry->length);
+        return entry->length;
+    }
+
+    size_t putBytes(const char *key, const void *value, size_t length) {
+        Entry *entry = find(key, true);
+        if (readOnly || entry == nullptr || length > sizeof(entry->value)) return 0;
+        if (entry->length != length || memcmp(entry->value, value, length) != 0) {
+            memcpy(entry->value, value, length);
+            entry->length = length;
+            writes++;
+        }
+        return length;
+    }
+
+    // Forget everything, as after erasing the flash
+    static void clear() { memset(entries, 0, sizeof(entries)); }
+
+private:
+    struct Entry {
+        char space[16];
+        char key[16];
+        uint8_t value[256];
+        size_t length;
+    };
+    static inline Entry entries[16] = {};
+
+    char space[16] = {};
+    bool readOnly = false;
+
+    template <typename T>
+    T get(const char *key, T defaultValue) {
+        T value;
+        return getBytes(key, &value, sizeof(value)) == sizeof(value) ? value : defaultValue;
+    }
+
+    Entry *find(const char *key, bool create) {
+        for (Entry &entry : entries) {
+            if (entry.length != 0 && strcmp(entry.space, space) == 0 && strcmp(entry.key, key) == 0) return &entry;
+        }
+        if (!create) return nullptr;
+        for (Entry &entry : entries) {
+            if (entry.length == 0) {
+                snprintf(entry.space, sizeof(entry.space), "%s", space);
+                snprintf(entry.key, sizeof(entry.key), "%s", key);
+                return &entry;
+            }
+        }
+        return nullptr;
+    }
+};
+
+#endif //MICROSCOPE_RINGLIGHT_CONTROLLER_TEST_PREFERENCES_H
@@ -0,0 +1,14 @@
+// Host stand-in for SPIFFS, files are never read
+#ifndef MICROSCOPE_RINGLIGHT_CONTROLLER_TEST_SPIFFS_H
+#define MICROSCOPE_RINGLIGHT_CONTROLLER_TEST_SPIFFS_H
+
+#include "FS.h"
+
+class SPIFFSFS : public fs::FS {
+public:
+    bool begin(bool formatOnFail = false) { return true; }
+};
+
+inline SPIFFSFS SPIFFS;
+
+#endif //MICROSCOPE_RINGLIGHT_CONTROLLER_TEST_SPIFFS_H
@@ -0,0 +1,7 @@
+// Host stand-in for esp_attr.h, there is no RTC memory so snapshots never survive a reset
+#ifndef MICROSCOPE_RINGLIGHT_CONTROLLER_TEST_ESP_ATTR_H
+#define MICROSCOPE_RINGLIGHT_CONTROLLER_TEST_ESP_ATTR_H
+
+#define RTC_NOINIT_ATTR
+
+#endif //MICROSCOPE_RINGLIGHT_CONTROLLER_TEST_ESP_ATTR_H
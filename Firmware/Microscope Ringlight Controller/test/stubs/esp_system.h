@@ -0,0 +1,26 @@
+// Host stand-in for esp_system.h, every start is a power-on
+#ifndef MICROSCOPE_RINGLIGHT_CONTROLLER_TEST_ESP_SYSTEM_H
+#define MICROSCOPE_RINGLIGHT_CONTROLLER_TEST_ESP_SYSTEM_H
+
+#include <cstdint>
+
+typedef enum {
+    ESP_RST_UNKNOWN,
+    ESP_RST_POWERON,
+    ESP_RST_EXT,
+    ESP_RST_SW,
+    ESP_RST_PANIC,
+} esp_reset_reason_t;
+
+inline esp_reset_reason_t esp_reset_reason() { return ESP_RST_POWERON; }
+
+// Repeatable sequence so runs can be compared
+inline uint32_t esp_random() {
+    static uint32_t state = 2463534242u;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+#endif //MICROSCOPE_RINGLIGHT_CONTROLLER_TEST_ESP_SYSTEM_H
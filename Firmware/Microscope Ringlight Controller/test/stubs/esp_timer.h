@@ -0,0 +1,9 @@
+// Host stand-in for esp_timer.h, on the simulated clock
+#ifndef MICROSCOPE_RINGLIGHT_CONTROLLER_TEST_ESP_TIMER_H
+#define MICROSCOPE_RINGLIGHT_CONTROLLER_TEST_ESP_TIMER_H
+
+#include <Arduino.h>
+
+inline int64_t esp_timer_get_time() { return int64_t(SimulatedMillis) * 1000; }
+
+#endif //MICROSCOPE_RINGLIGHT_CONTROLLER_TEST_ESP_TIMER_H
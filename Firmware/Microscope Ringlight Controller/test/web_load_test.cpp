@@ -0,0 +1,116 @@
+// Floods the web server with control requests while the main loop is not running, the way a
+// fast slider or a misbehaving client would, and checks that:
+//   - requests are accepted until the LED event queue holds EVENT_QUEUE_LIMIT events,
+//     then refused with 429 and Retry-After
+//   - a body larger than the control limit is refused with 413, whether or not the queue is full
+//   - live heap is the same after every flood once the queue has drained
+// Bodies arrive in small chunks, as they do over a slow connection. Nothing here depends on timing.
+#include <cstdio>
+#include <string>
+#include "LEDController.h"
+#include "EventLoop.h"
+#include "WebController.h"
+#include "heap_counter.h"
+
+const int FLOODS = 20;
+const int REQUESTS_PER_FLOOD = 3 * EVENT_QUEUE_LIMIT;
+const size_t CHUNK_SIZE = 5;
+
+static LEDController ledController;
+static GroupController groupController(ledController);
+static WebController webController(ledController, groupController);
+extern AsyncWebServer webserver;
+static AsyncWebServerRequest request;
+
+static int failures = 0;
+
+static void check(bool condition, const char *message) {
+    if (!condition) {
+        printf("FAIL: %s\n", message);
+        failures++;
+    }
+}
+
+static int post(const char *url, const std::string &body) {
+    request.reset(HTTP_POST, url, body.c_str());
+    webserver.handle(&request, CHUNK_SIZE);
+    return request.response.code;
+}
+
+// The n-th request of a flood, alternating between the three controls so no two neighbours merge
+// in the queue, always with a value that differs from the current one so none is skipped
+static int postControl(int n) {
+    char body[64];
+    switch (n % 3) {
+        case 0:
+            snprintf(body, sizeof(body), "{\"brightness\":%d}", ledController.currentBrightness == 10 ? 20 : 10);
+            return post("/brightness", body);
+        case 1:
+            snprintf(body, sizeof(body), "{\"temperature\":%d}", ledController.currentTemperature == 2000 ? 3000 : 2000);
+            return post("/temperature", body);
+        default:
+            snprintf(body, sizeof(body), "{\"direction\":%d}", ledController.currentDirection == 3 ? 4 : 3);
+            return post("/direction", body);
+    }
+}
+
+static bool refusedAsBusy() {
+    const String *retryAfter = request.response.header("Retry-After");
+    return request.response.code == 429 && retryAfter != nullptr && *retryAfter == "1";
+}
+
+// Flood until well past the point where the queue is full, then let the main loop drain it
+static void flood() {
+    int accepted = 0;
+    for (int n = 0; n < REQUESTS_PER_FLOOD; n++) {
+        bool full = LEDController::eventQueueFull();
+        int code = postControl(n);
+        if (!full) {
+            check(code == 200, "a request was refused before the event queue was full");
+            accepted += code == 200;
+        }
+        else {
+            check(refusedAsBusy(), "a request was not refused with 429 and Retry-After once the event queue was full");
+        }
+    }
+    check(accepted == int(EVENT_QUEUE_LIMIT), "the event queue did not fill at EVENT_QUEUE_LIMIT events");
+
+    // An oversize body is refused before it is buffered or parsed, whatever the queue holds
+    std::string oversize = "{\"brightness\":50,\"padding\":\"" + std::string(200, 'x') + "\"}";
+    check(post("/brightness", oversize) == 413, "an oversize body was not refused with 413 while the queue was full");
+
+    request.reset(HTTP_GET, "/getstate"); // frees the last body, as closing the connection does
+    ledController.Process();
+    check(!LEDController::eventQueueFull(), "the event queue did not drain");
+
+    check(post("/brightness", oversize) == 413, "an oversize body was not refused with 413");
+    check(ledController.currentBrightness != 50, "an oversize body was applied");
+    request.reset(HTTP_GET, "/getstate");
+}
+
+int main() {
+    Preferences::clear();
+    EventLoop::begin();
+    ledController.begin();
+    webController.begin();
+
+    // The first flood lets the queue and the other containers reach their largest size
+    flood();
+    int64_t settledBytes = liveBytes;
+
+    for (int i = 1; i < FLOODS; i++) {
+        flood();
+        if (liveBytes != settledBytes) {
+            printf("FAIL: live heap changed from %lld to %lld bytes after flood %d\n", (long long)settledBytes, (long long)liveBytes, i + 1);
+            failures++;
+            settledBytes = liveBytes;
+        }
+    }
+    printf("%d floods of %d requests, live heap %lld bytes after each\n", FLOODS, REQUESTS_PER_FLOOD, (long long)settledBytes);
+
+    if (failures > 0) {
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    return 0;
+}